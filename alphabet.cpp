@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/algorithm/string/join.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "alphabet.h"
+#include "symset.h"
+#include "sudoku.h"
+
+using namespace std;
+
+Alphabet::Alphabet(const vector<string> &tokens, bool numeric)
+  : tokens_(tokens), width_(0), numeric_(numeric) {
+  for (int i = 0; i < tokens.size(); i++) {
+    index_[tokens[i]] = i;
+    width_ = max<unsigned int>(width_, tokens[i].size());
+  }
+}
+
+// Orders characters as they appear in Sudoku::symbols, then any others.
+class symbol_order {
+public:
+  size_t rank(const string &tok) const {
+    size_t pos = Sudoku::symbols.find(tok[0]);
+    return pos == string::npos ? Sudoku::symbols.size() + tok[0] : pos;
+  }
+  bool operator()(const string &t1, const string &t2) const {
+    return rank(t1) < rank(t2);
+  }
+};
+
+const Alphabet *Alphabet::Get(unsigned int length,
+                              const vector<string> &given) {
+  if (length > Sudoku::symbols.size()) {
+    for (int i = 0; i < given.size(); i++) {
+      int n = atoi(given[i].c_str());
+      assert(n >= 1 && n <= length);
+    }
+    return Numeric(length);
+  }
+  vector<string> tokens (given);
+  sort(tokens.begin(), tokens.end());
+  tokens.erase(unique(tokens.begin(), tokens.end()), tokens.end());
+  assert(tokens.size() <= length);
+#ifdef VERBOSE
+  vector<string> added;
+#endif
+  for (int i = 0; i < Sudoku::symbols.size(); i++) {
+    if (tokens.size() == length)
+      break;
+    string sym (1, Sudoku::symbols[i]);
+    if (find(tokens.begin(), tokens.end(), sym) == tokens.end()) {
+      tokens.push_back(sym);
+#ifdef VERBOSE
+      added.push_back(sym);
+#endif
+    }
+  }
+  assert(tokens.size() == length);
+#ifdef VERBOSE
+  cout << "Added " << boost::algorithm::join(added, ", ")
+       << " to alphabet" << endl;
+#endif
+  sort(tokens.begin(), tokens.end(), symbol_order());
+
+  static boost::unordered_map<string, const Alphabet *> cache;
+  const Alphabet *&alphabet = cache[boost::algorithm::join(tokens, "")];
+  if (alphabet == NULL) {
+    for (int i = 0; i < tokens.size(); i++)
+      assert(tokens[i].size() == 1);
+    alphabet = new Alphabet(tokens, false);
+  }
+  return alphabet;
+}
+
+const Alphabet *Alphabet::Numeric(unsigned int length) {
+  assert(length <= symset::capacity);
+  static boost::unordered_map<unsigned int, const Alphabet *> cache;
+  const Alphabet *&alphabet = cache[length];
+  if (alphabet == NULL) {
+    vector<string> tokens;
+    for (int i = 1; i <= length; i++) {
+      stringstream str;
+      str << i;
+      tokens.push_back(str.str());
+    }
+    alphabet = new Alphabet(tokens, true);
+  }
+  return alphabet;
+}
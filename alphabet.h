@@ -0,0 +1,45 @@
+#ifndef __ALPHABET_HEADER__
+#define __ALPHABET_HEADER__
+
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+// The symbols of a puzzle. Domains hold indices into the alphabet, which
+// maps them back to the tokens used in puzzle files and output. Like
+// topologies, alphabets are shared and live for the rest of the process.
+class Alphabet {
+private:
+  std::vector<std::string> tokens_;
+  boost::unordered_map<std::string, int> index_;
+  unsigned int width_;
+  bool numeric_;
+
+  Alphabet(const std::vector<std::string> &tokens, bool numeric);
+
+public:
+  // Builds the alphabet of a puzzle of this length from the tokens of its
+  // givens. Puzzles up to the length of Sudoku::symbols use single
+  // characters, completed from Sudoku::symbols if some are not given.
+  // Larger puzzles use the numbers 1 to length.
+  static const Alphabet *Get(unsigned int length,
+                             const std::vector<std::string> &given);
+  static const Alphabet *Numeric(unsigned int length);
+
+  unsigned int size() const { return tokens_.size(); }
+  // Whether symbols are numbers rather than characters.
+  bool numeric() const { return numeric_; }
+  // The widest token.
+  unsigned int width() const { return width_; }
+
+  const std::string &operator[](int sym) const { return tokens_[sym]; }
+  const std::vector<std::string> &tokens() const { return tokens_; }
+  // The index of a token, or -1 if it is not in the alphabet.
+  int Find(const std::string &token) const {
+    boost::unordered_map<std::string, int>::const_iterator it =
+      index_.find(token);
+    return it == index_.end() ? -1 : it->second;
+  }
+};
+
+#endif // __ALPHABET_HEADER__
@@ -0,0 +1,392 @@
+// Microbenchmarks for the solver primitives, run on boards snapshotted
+// from puzzle files at several stages of a solve. Build with 'make bench'.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "corpus.h"
+#include "scheduler.h"
+#include "solve.h"
+#include "sudoku.h"
+
+using namespace std;
+
+// ---------------------------------------------------------------------------
+// ---------------------------- Instrumentation ------------------------------
+// ---------------------------------------------------------------------------
+
+// Counts every allocation, so kernels can be charged for theirs.
+static unsigned long allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (p == NULL)
+    throw bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+  free(p);
+}
+
+// User-space cycles from the hardware counters, where the kernel allows.
+class CycleCounter {
+private:
+  int fd_;
+
+public:
+  CycleCounter() {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  ~CycleCounter() {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  bool available() const { return fd_ >= 0; }
+  unsigned long long Read() const {
+    unsigned long long cycles = 0;
+    if (fd_ >= 0 && read(fd_, &cycles, sizeof(cycles)) != sizeof(cycles))
+      cycles = 0;
+    return cycles;
+  }
+};
+
+// ---------------------------------------------------------------------------
+// -------------------------------- Kernels ----------------------------------
+// ---------------------------------------------------------------------------
+
+// A board at one stage of solving one puzzle.
+struct snapshot {
+  string puzzle;
+  string path;
+  string stage;
+  Sudoku board;
+
+  snapshot(const string &puzzle, const string &path, const string &stage,
+           const Sudoku &board)
+    : puzzle(puzzle), path(path), stage(stage), board(board) { }
+};
+
+// Defeats dead code elimination of results.
+static volatile unsigned long sink;
+
+// One operation of a kernel. 'work' is a board restored from the
+// snapshot before each operation by kernels that change it.
+struct kernel {
+  const char *name;
+  // Whether the kernel changes the board and so needs restoring.
+  bool mutates;
+  // Whether to run only on the first stage, for kernels that read files.
+  bool file;
+  void (*op)(const snapshot &snap, Sudoku &work);
+};
+
+static void AC3Op(const snapshot &, Sudoku &work) {
+  sink += AC3(work);
+}
+
+static void SearchGroupForHiddenOp(const snapshot &, Sudoku &work) {
+  sink += SearchGroupForHidden(work, work.blocksize());
+}
+
+static void IntersectionsOp(const snapshot &, Sudoku &work) {
+  sink += Intersections(work);
+}
+
+static void FishOp(const snapshot &, Sudoku &work) {
+  sink += Fish(work, 3);
+}
+
+static void ColoringOp(const snapshot &, Sudoku &work) {
+  sink += Coloring(work);
+}
+
+static void AICOp(const snapshot &, Sudoku &work) {
+  sink += Chains(work, AIC);
+}
+
+static void TemplatesOp(const snapshot &, Sudoku &work) {
+  bool error = false;
+  sink += Templates(work, &error);
+}
+
+static void FindMostNakedPermsOp(const snapshot &, Sudoku &work) {
+  sink += FindMostNakedPerms(work, work.blocksize());
+}
+
+static void OrderedCellsOp(const snapshot &snap, Sudoku &) {
+  sink += snap.board.OrderedCells().size();
+}
+
+static void CloneOp(const snapshot &snap, Sudoku &) {
+  sink += snap.board.Clone().length();
+}
+
+static void ParseFromFileOp(const snapshot &snap, Sudoku &) {
+  sink += Sudoku::ParseFromFile(snap.path).length();
+}
+
+static void ToStringOp(const snapshot &snap, Sudoku &) {
+  sink += snap.board.ToString().size();
+}
+
+static const kernel kernels[] = {
+  {"AC3", true, false, AC3Op},
+  {"SearchGroupForHidden", true, false, SearchGroupForHiddenOp},
+  {"Intersections", true, false, IntersectionsOp},
+  {"Fish", true, false, FishOp},
+  {"Coloring", true, false, ColoringOp},
+  {"AIC", true, false, AICOp},
+  {"Templates", true, false, TemplatesOp},
+  {"FindMostNakedPerms", true, false, FindMostNakedPermsOp},
+  {"OrderedCells", false, false, OrderedCellsOp},
+  {"Clone", false, false, CloneOp},
+  {"ParseFromFile", false, true, ParseFromFileOp},
+  {"ToString", false, false, ToStringOp},
+};
+
+// ---------------------------------------------------------------------------
+// -------------------------------- Harness ----------------------------------
+// ---------------------------------------------------------------------------
+
+struct settings {
+  // Samples per measurement, after one discarded warmup sample.
+  unsigned int samples;
+  // The least time a sample runs for, in microseconds.
+  double min_micros;
+  // Puzzles larger than this are skipped unless named.
+  unsigned int max_length;
+  const char *filter;
+  vector<string> paths;
+
+  settings() : samples(9), min_micros(5000), max_length(36), filter(NULL) { }
+};
+
+struct measurement {
+  double ns;
+  // The median absolute deviation, as a fraction of 'ns'.
+  double spread;
+  double allocs;
+  double cycles;
+};
+
+// Times 'reps' operations, or only their restores if 'op' is false, adding
+// to the allocation and cycle counts.
+static double Run(const kernel &k, const snapshot &snap, Sudoku &work,
+                  unsigned long reps, bool op, const CycleCounter &counter,
+                  unsigned long *allocs, unsigned long long *cycles) {
+  unsigned long allocs_before = allocations;
+  unsigned long long cycles_before = counter.Read();
+  double start = Scheduler::Now();
+  for (unsigned long r = 0; r < reps; r++) {
+    if (k.mutates)
+      work.CopyFrom(snap.board);
+    if (op)
+      k.op(snap, work);
+  }
+  double micros = Scheduler::Now() - start;
+  *cycles += counter.Read() - cycles_before;
+  *allocs += allocations - allocs_before;
+  return micros;
+}
+
+// Measures a kernel on a snapshot. Mutating kernels are charged for their
+// operation only: each sample also times the restores alone, and those
+// are subtracted.
+static measurement Measure(const kernel &k, const snapshot &snap,
+                           const settings &set, const CycleCounter &counter) {
+  Sudoku work = snap.board.Clone();
+  unsigned long unused_allocs = 0;
+  unsigned long long unused_cycles = 0;
+  // Calibrate the repetitions so one sample takes min_micros.
+  unsigned long reps = 1;
+  for (;;) {
+    double micros = Run(k, snap, work, reps, true, counter, &unused_allocs,
+                        &unused_cycles);
+    if (micros >= set.min_micros || reps >= (1ul << 30))
+      break;
+    reps = micros < 1 ? reps * 16 :
+      max(reps + 1, static_cast<unsigned long>(reps * set.min_micros / micros));
+  }
+  vector<double> ns;
+  unsigned long allocs = 0, restore_allocs = 0;
+  unsigned long long cycles = 0, restore_cycles = 0;
+  for (unsigned int s = 0; s <= set.samples; s++) {
+    bool warmup = s == 0;
+    double micros = Run(k, snap, work, reps, true, counter,
+                        warmup ? &unused_allocs : &allocs,
+                        warmup ? &unused_cycles : &cycles);
+    if (k.mutates)
+      micros -= Run(k, snap, work, reps, false, counter,
+                    warmup ? &unused_allocs : &restore_allocs,
+                    warmup ? &unused_cycles : &restore_cycles);
+    if (!warmup)
+      ns.push_back(micros * 1000 / reps);
+  }
+  sort(ns.begin(), ns.end());
+  measurement m;
+  m.ns = ns[ns.size() / 2];
+  vector<double> deviations;
+  for (int s = 0; s < ns.size(); s++)
+    deviations.push_back(fabs(ns[s] - m.ns));
+  sort(deviations.begin(), deviations.end());
+  m.spread = m.ns > 0 ? deviations[deviations.size() / 2] / m.ns : 0;
+  double ops = static_cast<double>(reps) * set.samples;
+  m.allocs = (static_cast<double>(allocs) - restore_allocs) / ops;
+  m.cycles = (static_cast<double>(cycles) - restore_cycles) / ops;
+  return m;
+}
+
+// The puzzle files in a directory, skipping their .solved files.
+static vector<string> ListPuzzles(const string &dir) {
+  vector<string> paths;
+  DIR *d = opendir(dir.c_str());
+  if (d == NULL)
+    return paths;
+  while (dirent *entry = readdir(d)) {
+    string name = entry->d_name;
+    if (name[0] == '.' || name.find(".solved") != string::npos)
+      continue;
+    paths.push_back(dir + "/" + name);
+  }
+  closedir(d);
+  sort(paths.begin(), paths.end());
+  return paths;
+}
+
+// Snapshots a puzzle as given, after AC3, at the logic fixpoint, and
+// solved if there is a .solved file.
+static void Snapshot(const string &path, vector<snapshot> &snaps) {
+  string name = path.substr(path.rfind('/') + 1);
+  Sudoku given = Sudoku::ParseFromFile(path);
+  snaps.push_back(snapshot(name, path, "given", given));
+  Sudoku ac3 = given.Clone();
+  AC3(ac3);
+  snaps.push_back(snapshot(name, path, "ac3", ac3));
+  Sudoku logic = ac3.Clone();
+  LogicSolve(logic);
+  snaps.push_back(snapshot(name, path, "logic", logic));
+  tokengrid rows;
+  if (corpus::ReadSolvedRows(path + ".solved", given.length(), rows))
+    snaps.push_back(snapshot(name, path, "solved",
+                             Sudoku(rows, &given.topology())));
+}
+
+static void print_usage() {
+  cout << "bench [--filter substring] [--samples n] [--min-time ms]\n";
+  cout << "      [--max-length n] [puzzle...]\n\n";
+  cout << "Times each solver primitive on snapshots of the puzzles, by\n";
+  cout << "default those in puzzles/ up to --max-length (36). --filter\n";
+  cout << "keeps the kernels, puzzles or stages whose names contain it.\n";
+  cout << "Reports the median time per operation and its median absolute\n";
+  cout << "deviation, allocations per operation, and cycles per operation\n";
+  cout << "where perf counters are available, after the bytes a board of\n";
+  cout << "each size takes." << endl;
+  exit(0);
+}
+
+int main(int argc, char **argv) {
+  settings set;
+  for (int i = 1; i < argc; i++) {
+    bool more = i + 1 < argc;
+    if (strcmp(argv[i], "--filter") == 0 && more)
+      set.filter = argv[++i];
+    else if (strcmp(argv[i], "--samples") == 0 && more)
+      set.samples = max(1, atoi(argv[++i]));
+    else if (strcmp(argv[i], "--min-time") == 0 && more)
+      set.min_micros = atof(argv[++i]) * 1000;
+    else if (strcmp(argv[i], "--max-length") == 0 && more)
+      set.max_length = atoi(argv[++i]);
+    else if (strncmp(argv[i], "--", 2) == 0)
+      print_usage();
+    else
+      set.paths.push_back(argv[i]);
+  }
+  bool named = !set.paths.empty();
+  if (!named)
+    set.paths = ListPuzzles("puzzles");
+
+  vector<snapshot> snaps;
+  for (int p = 0; p < set.paths.size(); p++) {
+    ifstream puzzle (set.paths[p].c_str(), ifstream::in);
+    if (!named && Sudoku::ReadRows(puzzle).size() > set.max_length)
+      continue;
+    Snapshot(set.paths[p], snaps);
+  }
+
+  // What the boards measured take, ceil(length / 64) words per domain.
+  vector<bool> sized;
+  for (int s = 0; s < snaps.size(); s++) {
+    const Sudoku &board = snaps[s].board;
+    unsigned int length = board.length();
+    if (sized.size() <= length)
+      sized.resize(length + 1);
+    if (sized[length])
+      continue;
+    sized[length] = true;
+    size_t domains = length * length + board.topology().size() * length;
+    size_t bytes = board.words() * sizeof(uint64_t);
+    printf("%ux%u boards take %lu bytes, in domains of %lu\n", length,
+           length, static_cast<unsigned long>(domains * bytes),
+           static_cast<unsigned long>(bytes));
+  }
+  CycleCounter counter;
+  printf("%-21s %-20s %-6s %12s %7s %10s %12s\n", "kernel", "puzzle",
+         "stage", "ns/op", "+-", "allocs/op", "cycles/op");
+  for (int k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+    for (int s = 0; s < snaps.size(); s++) {
+      const snapshot &snap = snaps[s];
+      if (kernels[k].file && snap.stage != "given")
+        continue;
+      string label = string(kernels[k].name) + " " + snap.puzzle + " " +
+        snap.stage;
+      if (set.filter && label.find(set.filter) == string::npos)
+        continue;
+      measurement m = Measure(kernels[k], snap, set, counter);
+      char cycles[32] = "-";
+      if (counter.available())
+        snprintf(cycles, sizeof(cycles), "%.0f", m.cycles);
+      printf("%-21s %-20s %-6s %12.1f %6.1f%% %10.1f %12s\n",
+             kernels[k].name, snap.puzzle.c_str(), snap.stage.c_str(),
+             m.ns, m.spread * 100, m.allocs, cycles);
+      fflush(stdout);
+    }
+  }
+  return 0;
+}
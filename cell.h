@@ -0,0 +1,28 @@
+#ifndef __CELL_HEADER__
+#define __CELL_HEADER__
+
+#include <cstddef>
+#include <ostream>
+
+class cell {
+public:
+  unsigned int i;
+  unsigned int j;
+  
+  cell() { }
+  cell(unsigned int i, unsigned int j) : i(i), j(j) { }
+  
+  bool operator==(const cell &other) const {
+    return i == other.i && j == other.j;
+  }
+
+  bool operator!=(const cell &other) const {
+    return i != other.i || j != other.j;
+  }
+};
+
+std::ostream &operator<<(std::ostream &out, const cell &c);
+
+std::size_t hash_value(const cell &c);
+
+#endif // __CELL_HEADER__
@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "solve.h"
+#include "sudoku.h"
+
+using namespace std;
+
+// The most links a chain may have. Each search is a breadth-first walk
+// from one candidate, so this bounds how far it spreads on large boards.
+static const unsigned int MAX_CHAIN = 24;
+// Marks a candidate with no strong link.
+static const unsigned int NO_NODE = ~0u;
+
+// A candidate: symbol 'sym' in the cell at Topology::index() 'x'.
+struct candidate {
+  unsigned int x;
+  int sym;
+};
+
+// ---------------------------------------------------------------------------
+// ----------------------------- Link Graph ----------------------------------
+// ---------------------------------------------------------------------------
+
+// The candidates of a board with a strong link, and the links between
+// them in compressed adjacency arrays: the links of node n are
+// links[start[n]] to links[start[n + 1] - 1].
+//
+// A strong link joins two candidates of which at least one is true: the
+// only two places of a symbol in a unit (bilocation), or the only two
+// symbols of a cell (bivalue). A weak link joins two candidates of which
+// at most one is true: one symbol in two cells sharing a unit, or two
+// symbols of one cell. Removing candidates never breaks a link, so a
+// graph stays sound while the board it was built from is reduced.
+class LinkGraph {
+private:
+  const Sudoku &board_;
+  vector<candidate> nodes_;
+  // The node of each candidate, at x * length + sym, or NO_NODE.
+  vector<unsigned int> ids_;
+  vector<unsigned int> strong_start_, strong_;
+  vector<unsigned int> weak_start_, weak_;
+
+public:
+  // Uses bilocation and bivalue strong links as asked. Weak links between
+  // the symbols of a cell are only followed if 'in_cell'.
+  LinkGraph(const Sudoku &board, bool bilocation, bool bivalue,
+            bool in_cell);
+
+  unsigned int size() const { return nodes_.size(); }
+  const candidate &node(unsigned int n) const { return nodes_[n]; }
+
+  const unsigned int *strong_begin(unsigned int n) const {
+    return &strong_[0] + strong_start_[n];
+  }
+  const unsigned int *strong_end(unsigned int n) const {
+    return &strong_[0] + strong_start_[n + 1];
+  }
+  // Weak links to other nodes only.
+  const unsigned int *weak_begin(unsigned int n) const {
+    return &weak_[0] + weak_start_[n];
+  }
+  const unsigned int *weak_end(unsigned int n) const {
+    return &weak_[0] + weak_start_[n + 1];
+  }
+
+private:
+  unsigned int Node(unsigned int x, int sym);
+  // Sorts links into adjacency arrays, dropping duplicates.
+  static void Compress(vector<pair<unsigned int, unsigned int> > &links,
+                       unsigned int nodes, vector<unsigned int> &start,
+                       vector<unsigned int> &adjacent);
+};
+
+LinkGraph::LinkGraph(const Sudoku &board, bool bilocation, bool bivalue,
+                     bool in_cell)
+  : board_(board), ids_(board.length() * board.length() * board.length(),
+                        NO_NODE) {
+  const Topology &topo = board.topology();
+  unsigned int length = board.length();
+  vector<pair<unsigned int, unsigned int> > links;
+  if (bilocation) {
+    for (unsigned int u = 0; u < topo.size(); u++) {
+      const vector<cell> &unit = topo.unit(u);
+      for (int sym = 0; sym < length; sym++) {
+        const symset &where = board.places(u, sym);
+        if (where.size() != 2)
+          continue;
+        symset::const_iterator p = where.begin();
+        const cell &c1 = unit[*p];
+        const cell &c2 = unit[*++p];
+        if (board[c1].single() || board[c2].single())
+          continue;
+        unsigned int n1 = Node(topo.index(c1), sym);
+        unsigned int n2 = Node(topo.index(c2), sym);
+        links.push_back(make_pair(n1, n2));
+        links.push_back(make_pair(n2, n1));
+      }
+    }
+  }
+  if (bivalue) {
+    for (unsigned int x = 0; x < length * length; x++) {
+      const symset &dom = board[cell(x / length, x % length)];
+      if (dom.size() != 2)
+        continue;
+      unsigned int n1 = Node(x, dom.front());
+      unsigned int n2 = Node(x, *++dom.begin());
+      links.push_back(make_pair(n1, n2));
+      links.push_back(make_pair(n2, n1));
+    }
+  }
+  Compress(links, nodes_.size(), strong_start_, strong_);
+
+  links.clear();
+  for (unsigned int n = 0; n < nodes_.size(); n++) {
+    const candidate &c = nodes_[n];
+    const vector<cell> &peers = topo.peers(cell(c.x / length, c.x % length));
+    for (vector<cell>::const_iterator it = peers.begin();
+         it != peers.end(); ++it) {
+      unsigned int m = ids_[topo.index(*it) * length + c.sym];
+      if (m != NO_NODE)
+        links.push_back(make_pair(n, m));
+    }
+    if (in_cell) {
+      for (int sym = 0; sym < length; sym++) {
+        unsigned int m = ids_[c.x * length + sym];
+        if (m != NO_NODE && m != n)
+          links.push_back(make_pair(n, m));
+      }
+    }
+  }
+  Compress(links, nodes_.size(), weak_start_, weak_);
+}
+
+unsigned int LinkGraph::Node(unsigned int x, int sym) {
+  unsigned int &id = ids_[x * board_.length() + sym];
+  if (id == NO_NODE) {
+    id = nodes_.size();
+    candidate c;
+    c.x = x;
+    c.sym = sym;
+    nodes_.push_back(c);
+  }
+  return id;
+}
+
+void LinkGraph::Compress(vector<pair<unsigned int, unsigned int> > &links,
+                         unsigned int nodes, vector<unsigned int> &start,
+                         vector<unsigned int> &adjacent) {
+  sort(links.begin(), links.end());
+  links.erase(unique(links.begin(), links.end()), links.end());
+  start.assign(nodes + 1, 0);
+  adjacent.resize(links.size() + 1);
+  for (unsigned int k = 0; k < links.size(); k++) {
+    start[links[k].first + 1]++;
+    adjacent[k] = links[k].second;
+  }
+  for (unsigned int n = 0; n < nodes; n++)
+    start[n + 1] += start[n];
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------- Simple Coloring -------------------------------
+// ---------------------------------------------------------------------------
+
+// Per-cell marks that are cleared in O(1) by starting a new round.
+class marks {
+private:
+  vector<unsigned int> round_;
+  unsigned int current_;
+public:
+  explicit marks(unsigned int cells) : round_(cells, 0), current_(0) { }
+  void clear() { current_++; }
+  void set(unsigned int x) { round_[x] = current_; }
+  bool test(unsigned int x) const { return round_[x] == current_; }
+};
+
+static symset Only(int sym) {
+  symset syms;
+  syms.insert(sym);
+  return syms;
+}
+
+/**
+ * for each symbol s:
+ *   2-color each component of the bilocation links of s
+ *   if two cells of one color share a unit, that color is false
+ *   a cell seeing both colors of a component cannot hold s
+ */
+bool Coloring(Sudoku &board, vector<unsigned long> *by_size) {
+  const Topology &topo = board.topology();
+  unsigned int length = board.length();
+  LinkGraph graph (board, true, false, false);
+  vector<int> color (graph.size(), -1);
+  vector<unsigned int> component;
+  marks colored[2] = {marks(length * length), marks(length * length)};
+  marks seen[2] = {marks(length * length), marks(length * length)};
+  unsigned int removed = 0;
+  for (unsigned int root = 0; root < graph.size(); root++) {
+    if (color[root] >= 0)
+      continue;
+    int sym = graph.node(root).sym;
+    component.clear();
+    color[root] = 0;
+    component.push_back(root);
+    for (unsigned int k = 0; k < component.size(); k++) {
+      unsigned int n = component[k];
+      for (const unsigned int *m = graph.strong_begin(n);
+           m != graph.strong_end(n); ++m) {
+        if (color[*m] < 0) {
+          color[*m] = 1 - color[n];
+          component.push_back(*m);
+        }
+      }
+    }
+    for (int k = 0; k < 2; k++) {
+      colored[k].clear();
+      seen[k].clear();
+    }
+    for (unsigned int k = 0; k < component.size(); k++)
+      colored[color[component[k]]].set(graph.node(component[k]).x);
+    // A color seeing itself is false, so the other color is true.
+    int wrong = -1;
+    for (unsigned int k = 0; k < component.size() && wrong < 0; k++) {
+      const candidate &c = graph.node(component[k]);
+      const vector<cell> &peers = topo.peers(cell(c.x / length,
+                                                  c.x % length));
+      for (vector<cell>::const_iterator it = peers.begin();
+           it != peers.end(); ++it) {
+        if (colored[color[component[k]]].test(topo.index(*it))) {
+          wrong = color[component[k]];
+          break;
+        }
+      }
+    }
+    if (wrong >= 0) {
+      for (unsigned int k = 0; k < component.size(); k++) {
+        const candidate &c = graph.node(component[k]);
+        cell at (c.x / length, c.x % length);
+        if (color[component[k]] == wrong)
+          removed += board.Subtract(at, Only(sym));
+        else
+          removed += board.Restrict(at, Only(sym));
+      }
+      continue;
+    }
+    // One color is true, so cells seeing both lose the symbol.
+    for (unsigned int k = 0; k < component.size(); k++) {
+      const candidate &c = graph.node(component[k]);
+      const vector<cell> &peers = topo.peers(cell(c.x / length,
+                                                  c.x % length));
+      for (vector<cell>::const_iterator it = peers.begin();
+           it != peers.end(); ++it)
+        seen[color[component[k]]].set(topo.index(*it));
+    }
+    for (unsigned int x = 0; x < length * length; x++)
+      if (seen[0].test(x) && seen[1].test(x) && !colored[0].test(x) &&
+          !colored[1].test(x))
+        removed += board.Subtract(cell(x / length, x % length), Only(sym));
+  }
+  if (by_size)
+    (*by_size)[0] += removed;
+  return removed > 0;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- Chains ------------------------------------
+// ---------------------------------------------------------------------------
+
+// Given that 'a' or 'z' is true, removes the candidates weakly linked to
+// both. Returns the number of symbols removed.
+static unsigned int RemoveSeeingBoth(Sudoku &board, const candidate &a,
+                                     const candidate &z, marks &near) {
+  const Topology &topo = board.topology();
+  unsigned int length = board.length();
+  cell ca (a.x / length, a.x % length), cz (z.x / length, z.x % length);
+  if (a.x == z.x) {
+    symset keep = Only(a.sym);
+    keep.insert(z.sym);
+    return board.Restrict(ca, keep);
+  }
+  const vector<cell> &peers = topo.peers(ca);
+  near.clear();
+  for (vector<cell>::const_iterator it = peers.begin();
+       it != peers.end(); ++it)
+    near.set(topo.index(*it));
+  if (a.sym != z.sym) {
+    if (!near.test(z.x))
+      return 0;
+    return board.Subtract(ca, Only(z.sym)) + board.Subtract(cz, Only(a.sym));
+  }
+  unsigned int removed = 0;
+  const vector<cell> &others = topo.peers(cz);
+  for (vector<cell>::const_iterator it = others.begin();
+       it != others.end(); ++it)
+    if (near.test(topo.index(*it)))
+      removed += board.Subtract(*it, Only(a.sym));
+  return removed;
+}
+
+/**
+ * for each candidate a with a strong link:
+ *   assume a false, and follow strong links to true candidates and weak
+ *   links to false ones, breadth first
+ *   for each z found true, a or z is true: remove what sees both
+ *   if a candidate is found both true and false, a is true
+ *
+ * X-chains follow one symbol through bilocation links, XY-chains
+ * bivalue cells, and alternating inference chains (AIC) both.
+ */
+bool Chains(Sudoku &board, strategy kind, vector<unsigned long> *by_size) {
+  unsigned int length = board.length();
+  LinkGraph graph (board, kind != XY_CHAIN, kind != X_CHAIN, kind == AIC);
+  // The round each node was last reached true, or false, from.
+  vector<unsigned int> on (graph.size(), NO_NODE);
+  vector<unsigned int> off (graph.size(), NO_NODE);
+  // Nodes reached, with the links taken to reach them.
+  vector<pair<unsigned int, unsigned int> > queue;
+  marks near (length * length);
+  unsigned int removed = 0;
+  for (unsigned int a = 0; a < graph.size(); a++) {
+    const candidate &start = graph.node(a);
+    if (!board[cell(start.x / length, start.x % length)].count(start.sym))
+      continue;
+    bool contradiction = false;
+    queue.clear();
+    queue.push_back(make_pair(a, 0));
+    off[a] = a;
+    for (unsigned int k = 0; k < queue.size() && !contradiction; k++) {
+      unsigned int n = queue[k].first, links = queue[k].second;
+      if (links == MAX_CHAIN)
+        continue;
+      // Even link counts reach false candidates, odd ones true.
+      if (links % 2 == 0) {
+        for (const unsigned int *m = graph.strong_begin(n);
+             m != graph.strong_end(n); ++m) {
+          if (on[*m] == a)
+            continue;
+          on[*m] = a;
+          if (off[*m] == a) {
+            contradiction = true;
+            break;
+          }
+          if (*m != a)
+            removed += RemoveSeeingBoth(board, start, graph.node(*m), near);
+          queue.push_back(make_pair(*m, links + 1));
+        }
+      }
+      else {
+        for (const unsigned int *m = graph.weak_begin(n);
+             m != graph.weak_end(n); ++m) {
+          if (off[*m] == a)
+            continue;
+          off[*m] = a;
+          if (on[*m] == a) {
+            contradiction = true;
+            break;
+          }
+          queue.push_back(make_pair(*m, links + 1));
+        }
+      }
+    }
+    if (contradiction)
+      removed += board.Restrict(cell(start.x / length, start.x % length),
+                                Only(start.sym));
+  }
+  if (by_size)
+    (*by_size)[0] += removed;
+  return removed > 0;
+}
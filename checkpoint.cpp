@@ -0,0 +1,299 @@
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "io.h"
+
+using namespace std;
+
+// Nodes searched between looks at the clock.
+static const unsigned long CHECKPOINT_NODES = 16;
+
+// Appends the bytes of 'value'.
+template <class T>
+static void Put(string &out, const T &value) {
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// Reads a value at 'at', moving past it. Returns false at the end.
+template <class T>
+static bool Take(const string &in, size_t &at, T *value) {
+  if (in.size() - at < sizeof(T))
+    return false;
+  memcpy(value, in.data() + at, sizeof(T));
+  at += sizeof(T);
+  return true;
+}
+
+static unsigned int DomainBytes(unsigned int length) {
+  return (length + 7) / 8;
+}
+
+static void PutDomain(string &out, const symset &dom, unsigned int bytes) {
+  for (unsigned int b = 0; b < bytes; b++)
+    out += static_cast<char>(dom.word(b / 8) >> (b % 8 * 8));
+}
+
+static bool TakeDomain(const string &in, size_t &at, unsigned int length,
+                       symset *dom) {
+  unsigned int bytes = DomainBytes(length);
+  if (in.size() - at < bytes)
+    return false;
+  *dom = symset();
+  for (unsigned int b = 0; b < bytes; b++) {
+    uint64_t byte = static_cast<unsigned char>(in[at + b]);
+    dom->set_word(b / 8, dom->word(b / 8) | byte << (b % 8 * 8));
+  }
+  at += bytes;
+  return dom->subsetof(symset::All(length));
+}
+
+namespace checkpoint {
+
+uint64_t Fingerprint(const Sudoku &puzzle) {
+  unsigned int length = puzzle.length();
+  string bytes = puzzle.topology().ToString();
+  const vector<string> &tokens = puzzle.alphabet().tokens();
+  for (int k = 0; k < tokens.size(); k++)
+    bytes += tokens[k] + '\0';
+  for (unsigned int x = 0; x < length * length; x++)
+    PutDomain(bytes, puzzle[x / length][x % length], DomainBytes(length));
+  // 64-bit FNV-1a.
+  uint64_t hash = 14695981039346656037ul;
+  for (size_t k = 0; k < bytes.size(); k++) {
+    hash ^= static_cast<unsigned char>(bytes[k]);
+    hash *= 1099511628211ul;
+  }
+  return hash;
+}
+
+}  // namespace checkpoint
+
+// ---------------------------------------------------------------------------
+// ---------------------------- Save and Restore -----------------------------
+// ---------------------------------------------------------------------------
+
+void SaveSearch(const Search &search, const Sudoku &puzzle, string &state) {
+  unsigned int length = puzzle.length();
+  unsigned int bytes = DomainBytes(length);
+  checkpoint::header h;
+  memcpy(h.magic, checkpoint::magic, sizeof(h.magic));
+  h.version = checkpoint::version;
+  h.length = length;
+  h.bytes = bytes;
+  h.frames = search.stack_.size();
+  h.reserved = 0;
+  h.puzzle = checkpoint::Fingerprint(puzzle);
+  h.nodes = search.nodes_;
+  state.clear();
+  Put(state, h);
+  vector<uint32_t> cells;
+  for (int k = 0; k < search.stack_.size(); k++) {
+    const Search::frame &f = search.stack_[k];
+    Put<uint32_t>(state, f.guess.i);
+    Put<uint32_t>(state, f.guess.j);
+    Put<uint32_t>(state, f.next);
+    Put<uint32_t>(state, f.order.size());
+    for (int g = 0; g < f.order.size(); g++)
+      Put<uint32_t>(state, f.order[g]);
+    cells.clear();
+    for (unsigned int x = 0; x < length * length; x++) {
+      const symset &dom = f.board[x / length][x % length];
+      if (k == 0 || dom != search.stack_[k - 1].board[x / length][x % length])
+        cells.push_back(x);
+    }
+    Put<uint32_t>(state, cells.size());
+    for (int c = 0; c < cells.size(); c++) {
+      Put(state, cells[c]);
+      PutDomain(state, f.board[cells[c] / length][cells[c] % length], bytes);
+    }
+  }
+}
+
+bool RestoreSearch(Search &search, const Sudoku &puzzle,
+                   const string &state) {
+  assert(!search.started_);
+  unsigned int length = puzzle.length();
+  size_t at = 0;
+  checkpoint::header h;
+  if (!Take(state, at, &h) ||
+      memcmp(h.magic, checkpoint::magic, sizeof(h.magic)) != 0 ||
+      h.version != checkpoint::version || h.length != length ||
+      h.bytes != DomainBytes(length) ||
+      h.puzzle != checkpoint::Fingerprint(puzzle))
+    return false;
+  vector<Search::frame> stack;
+  for (uint32_t k = 0; k < h.frames; k++) {
+    uint32_t i, j, next, guesses, cells;
+    if (!Take(state, at, &i) || !Take(state, at, &j) ||
+        !Take(state, at, &next) || !Take(state, at, &guesses) ||
+        i >= length || j >= length || guesses > length || next > guesses)
+      return false;
+    // Every frame but the top was guessed from.
+    if (next == 0 && k + 1 < h.frames)
+      return false;
+    vector<int> order (guesses);
+    for (uint32_t g = 0; g < guesses; g++) {
+      uint32_t sym;
+      if (!Take(state, at, &sym) || sym >= length)
+        return false;
+      order[g] = sym;
+    }
+    Sudoku board = k == 0 ? puzzle.Clone() : stack.back().board.Clone();
+    if (!Take(state, at, &cells) || cells > length * length)
+      return false;
+    for (uint32_t c = 0; c < cells; c++) {
+      uint32_t x;
+      symset dom;
+      if (!Take(state, at, &x) || x >= length * length ||
+          !TakeDomain(state, at, length, &dom))
+        return false;
+      board.Set(cell(x / length, x % length), dom);
+    }
+    Search::frame f (board);
+    f.guess = cell(i, j);
+    f.order = order;
+    f.next = next;
+    stack.push_back(f);
+  }
+  if (at != state.size())
+    return false;
+  search.stack_.swap(stack);
+  search.nodes_ = h.nodes;
+  search.started_ = !search.stack_.empty();
+  if (search.started_)
+    search.board_.CopyFrom(search.stack_[0].board);
+  // Opens the spans of the guesses on the stack, as running to here would.
+  Tracer *trace = search.ctx_.trace;
+  for (size_t k = 1; trace && k < search.stack_.size(); k++) {
+    const Search::frame &from = search.stack_[k - 1];
+    trace->Guess(from.guess,
+                 puzzle.alphabet()[from.order[from.next - 1]]);
+  }
+  return true;
+}
+
+bool ReadCheckpoint(const string &path, string &state) {
+  ifstream in (path.c_str(), ifstream::in | ifstream::binary);
+  if (!in.good())
+    return false;
+  state.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+  return !in.bad();
+}
+
+// ---------------------------------------------------------------------------
+// -------------------------------- Writer -----------------------------------
+// ---------------------------------------------------------------------------
+
+// Each checkpoint is written here first, then renamed over the last.
+static string Temporary(const string &path) {
+  return path + ".tmp";
+}
+
+Checkpointer::Checkpointer(const string &path)
+  : path_(path), waiting_(false), stop_(false), error_(0) {
+  writer_ = thread(&Checkpointer::Write, this);
+}
+
+Checkpointer::~Checkpointer() {
+  Close();
+}
+
+int Checkpointer::Close() {
+  if (!writer_.joinable())
+    return error_;
+  {
+    lock_guard<mutex> hold (lock_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  writer_.join();
+  return error_;
+}
+
+bool Checkpointer::Writable(const string &path) {
+  string temporary = Temporary(path);
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return false;
+  close(fd);
+  unlink(temporary.c_str());
+  return true;
+}
+
+void Checkpointer::Offer(string &state) {
+  {
+    lock_guard<mutex> hold (lock_);
+    pending_.swap(state);
+    waiting_ = true;
+  }
+  wake_.notify_one();
+}
+
+void Checkpointer::Write() {
+  string state;
+  string temporary = Temporary(path_);
+  for (;;) {
+    {
+      unique_lock<mutex> hold (lock_);
+      while (!waiting_ && !stop_)
+        wake_.wait(hold);
+      if (!waiting_)
+        return;
+      state.swap(pending_);
+      waiting_ = false;
+    }
+    int error = Save(state, temporary);
+    lock_guard<mutex> hold (lock_);
+    error_ = error;
+  }
+}
+
+int Checkpointer::Save(const string &state, const string &temporary) {
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return errno;
+  // On disk before it replaces the last one.
+  bool written = WriteAll(fd, state.data(), state.size()) && fsync(fd) == 0;
+  int error = written ? 0 : errno;
+  if (close(fd) < 0 && written) {
+    written = false;
+    error = errno;
+  }
+  if (written && rename(temporary.c_str(), path_.c_str()) == 0)
+    return 0;
+  if (written)
+    error = errno;
+  // Leaves the last checkpoint in place.
+  unlink(temporary.c_str());
+  return error;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- Searching ---------------------------------
+// ---------------------------------------------------------------------------
+
+solvestatus RunCheckpointed(Search &search, const Sudoku &puzzle,
+                            Checkpointer &saver, double seconds) {
+  string state;
+  double last = Scheduler::Now();
+  while (!search.Run(CHECKPOINT_NODES)) {
+    if (Scheduler::Now() - last < seconds * 1e6)
+      continue;
+    SaveSearch(search, puzzle, state);
+    saver.Offer(state);
+    last = Scheduler::Now();
+  }
+  if (search.status() == TIMED_OUT) {
+    SaveSearch(search, puzzle, state);
+    saver.Offer(state);
+  }
+  return search.status();
+}
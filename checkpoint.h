@@ -0,0 +1,111 @@
+#ifndef __CHECKPOINT_HEADER__
+#define __CHECKPOINT_HEADER__
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <stdint.h>
+
+#include "solve.h"
+#include "sudoku.h"
+
+// The state of a Search part way, to be resumed on the same puzzle. All
+// integers are stored in host byte order.
+//
+//   header  magic "SDKS", u32 version, u32 length, u32 bytes per
+//           domain, u32 frames, u32 reserved, u64 puzzle fingerprint,
+//           u64 nodes searched
+//   frames  one per board on the guess stack, root first: u32 guess row,
+//           u32 guess column, u32 next guess, u32 guesses, u32 symbol per
+//           guess, u32 cells stored, then per cell stored u32 index and
+//           its domain
+//
+// The root frame stores every cell; each later frame stores only the
+// cells whose domains differ from the frame before it, which guessing
+// and logic narrow a few at a time. A domain takes ceil(length / 8)
+// bytes, symbol 0 in the lowest bit of the first: the root of a 64x64
+// board takes 48 KB, and each frame after it a few hundred bytes more.
+// A search not yet started has no frames. The fingerprint hashes the
+// puzzle's givens, alphabet and variant lines, so a checkpoint only
+// resumes its puzzle.
+namespace checkpoint {
+
+static const char magic[4] = { 'S', 'D', 'K', 'S' };
+static const uint32_t version = 1;
+
+struct header {
+  char magic[4];
+  uint32_t version;
+  uint32_t length;
+  uint32_t bytes;
+  uint32_t frames;
+  uint32_t reserved;
+  uint64_t puzzle;
+  uint64_t nodes;
+};
+
+// A hash of the puzzle a search started from.
+uint64_t Fingerprint(const Sudoku &puzzle);
+
+}  // namespace checkpoint
+
+// Replaces 'state' with that of 'search', started on 'puzzle', in the
+// format above.
+void SaveSearch(const Search &search, const Sudoku &puzzle,
+                std::string &state);
+// Replaces the state of a search not yet run with 'state'. Returns false,
+// leaving it as it was, if 'state' is not a checkpoint of a search of
+// 'puzzle' in this version.
+bool RestoreSearch(Search &search, const Sudoku &puzzle,
+                   const std::string &state);
+// Reads a whole checkpoint file. Returns false if it cannot be read.
+bool ReadCheckpoint(const std::string &path, std::string &state);
+
+// Writes checkpoints from a thread of its own, so a search only stops to
+// copy its state. Each is written to a temporary file that is then
+// renamed over 'path', so a crash leaves the previous one whole, as does
+// a failure to write it. States offered faster than they are written
+// replace those still waiting.
+class Checkpointer {
+private:
+  std::string path_;
+  std::mutex lock_;
+  std::condition_variable wake_;
+  std::string pending_;
+  bool waiting_;
+  bool stop_;
+  std::thread writer_;
+  // The errno of the last checkpoint written, or 0 if it succeeded.
+  int error_;
+
+public:
+  explicit Checkpointer(const std::string &path);
+  // Closes, if not closed already.
+  ~Checkpointer();
+
+  // Whether checkpoints can be written to 'path', tried by creating and
+  // removing the temporary file beside it.
+  static bool Writable(const std::string &path);
+
+  // Hands 'state' to the writer. Swaps, so the caller's string is
+  // reused for the next one.
+  void Offer(std::string &state);
+
+  // Writes the state still waiting, if any, then stops. Returns 0 if
+  // the last checkpoint was written, or the errno of its failure, in
+  // which case 'path' still holds the one before, if any.
+  int Close();
+
+private:
+  void Write();
+  // Writes 'state' through 'temporary' to 'path_'. Returns 0 or errno.
+  int Save(const std::string &state, const std::string &temporary);
+};
+
+// Runs 'search' of 'puzzle' to the end, offering its state to 'saver'
+// every 'seconds', and once more if it runs out of budget.
+solvestatus RunCheckpointed(Search &search, const Sudoku &puzzle,
+                            Checkpointer &saver, double seconds);
+
+#endif // __CHECKPOINT_HEADER__
@@ -0,0 +1,380 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "corpus.h"
+#include "sudoku.h"
+
+using namespace std;
+
+namespace corpus {
+
+unsigned int CellBits(unsigned int length) {
+  unsigned int bits = 1;
+  while ((1u << bits) < length + 1)
+    bits++;
+  return bits;
+}
+
+bool ReadSolvedRows(const string &path, unsigned int length,
+                    tokengrid &rows) {
+  ifstream in (path.c_str(), ifstream::in);
+  if (!in.good())
+    return false;
+  tokengrid grid;
+  string line;
+  while (getline(in, line)) {
+    stringstream tokens (line);
+    vector<string> row;
+    string tok;
+    bool ok = true;
+    while (tokens >> tok) {
+      if (tok == "|")
+        continue;
+      // Block separators and anything else that is not a symbol.
+      if (tok[0] == '-' || (length <= Sudoku::symbols.size() &&
+                            tok.size() != 1)) {
+        ok = false;
+        break;
+      }
+      row.push_back(tok);
+    }
+    if (ok && row.size() == length)
+      grid.push_back(row);
+  }
+  if (grid.size() < length)
+    return false;
+  rows.assign(grid.end() - length, grid.end());
+  for (int i = 0; i < length; i++)
+    for (int j = 0; j < length; j++)
+      if (rows[i][j] == string(1, Sudoku::unknown))
+        return false;
+  return true;
+}
+
+// Rounds up to the record alignment.
+static size_t Align(size_t n) {
+  return (n + 7) & ~static_cast<size_t>(7);
+}
+
+static size_t PackedBytes(unsigned int length) {
+  return Align((length * length * CellBits(length) + 7) / 8);
+}
+
+}  // namespace corpus
+
+// ---------------------------------------------------------------------------
+// ------------------------------- Writer ------------------------------------
+// ---------------------------------------------------------------------------
+
+CorpusWriter::CorpusWriter(const string &path, const Topology *topology,
+                           bool solutions)
+  : out_(path.c_str(), ofstream::out | ofstream::binary | ofstream::trunc),
+    topology_(topology), length_(topology->length()),
+    bits_(corpus::CellBits(length_)), solutions_(solutions) {
+  if (length_ > Sudoku::symbols.size())
+    alphabet_ = Alphabet::Numeric(length_)->tokens();
+  assert(out_.good());
+  assert(!topology->jigsaw());
+  // Placeholder, rewritten by Close() once the count is known.
+  vector<char> header (sizeof(corpus::header) + corpus::Align(length_), 0);
+  out_.write(&header[0], header.size());
+}
+
+CorpusWriter::~CorpusWriter() {
+  if (out_.is_open())
+    Close();
+}
+
+unsigned int CorpusWriter::Code(const string &sym) {
+  if (sym == string(1, Sudoku::unknown))
+    return 0;
+  size_t pos = find(alphabet_.begin(), alphabet_.end(), sym) -
+    alphabet_.begin();
+  if (pos == alphabet_.size()) {
+    assert(alphabet_.size() < length_ && sym.size() == 1);
+    alphabet_.push_back(sym);
+  }
+  return pos + 1;
+}
+
+void CorpusWriter::Pack(const tokengrid &rows, size_t bytes) {
+  assert(rows.size() == length_);
+  record_.assign(bytes, 0);
+  unsigned int bit = 0;
+  for (int i = 0; i < length_; i++) {
+    assert(rows[i].size() == length_);
+    for (int j = 0; j < length_; j++, bit += bits_) {
+      unsigned int code = Code(rows[i][j]);
+      for (unsigned int b = 0; b < bits_; b++)
+        if (code & (1u << b))
+          record_[(bit + b) / 8] |= 1 << ((bit + b) % 8);
+    }
+  }
+  out_.write(reinterpret_cast<const char *>(&record_[0]), bytes);
+}
+
+void CorpusWriter::Add(const tokengrid &givens, const tokengrid *solution) {
+  assert((solution != NULL) == solutions_);
+  offsets_.push_back(out_.tellp());
+  size_t bytes = corpus::PackedBytes(length_);
+  Pack(givens, bytes);
+  if (solution)
+    Pack(*solution, bytes);
+  assert(out_.good());
+}
+
+void CorpusWriter::Close() {
+  // Fill unused codes the same way Sudoku completes a partial alphabet, so
+  // decoded puzzles get exactly the symbols a text parse would give them.
+  for (int i = 0; i < Sudoku::symbols.size() && alphabet_.size() < length_;
+       i++) {
+    string sym (1, Sudoku::symbols[i]);
+    if (find(alphabet_.begin(), alphabet_.end(), sym) == alphabet_.end())
+      alphabet_.push_back(sym);
+  }
+  bool numeric = length_ > Sudoku::symbols.size();
+
+  corpus::header h;
+  memcpy(h.magic, corpus::magic, sizeof(h.magic));
+  h.version = corpus::version;
+  h.length = length_;
+  h.bits = bits_;
+  h.flags = solutions_ ? corpus::FLAG_SOLUTIONS : 0;
+  if (topology_->diagonal())
+    h.flags |= corpus::FLAG_DIAGONAL;
+  if (topology_->windoku())
+    h.flags |= corpus::FLAG_WINDOKU;
+  if (numeric)
+    h.flags |= corpus::FLAG_NUMERIC;
+  h.reserved = 0;
+  h.count = offsets_.size();
+  h.index = out_.tellp();
+  if (!offsets_.empty())
+    out_.write(reinterpret_cast<const char *>(&offsets_[0]),
+               offsets_.size() * sizeof(uint64_t));
+  out_.seekp(0);
+  out_.write(reinterpret_cast<const char *>(&h), sizeof(h));
+  if (!numeric)
+    for (int i = 0; i < alphabet_.size(); i++)
+      out_.write(alphabet_[i].data(), 1);
+  assert(out_.good());
+  out_.close();
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- Reader ------------------------------------
+// ---------------------------------------------------------------------------
+
+Corpus::Corpus()
+  : data_(NULL), bytes_(0), header_(&none_), index_(NULL), topology_(NULL),
+    symbols_(NULL) {
+  memset(&none_, 0, sizeof(none_));
+}
+
+bool Corpus::Open(const string &path, string *error) {
+  assert(data_ == NULL);
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *error = strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    *error = strerror(errno);
+    close(fd);
+    return false;
+  }
+  if (st.st_size == 0) {
+    *error = "not a corpus";
+    close(fd);
+    return false;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  int failed = errno;
+  close(fd);
+  if (map == MAP_FAILED) {
+    *error = strerror(failed);
+    return false;
+  }
+  data_ = static_cast<const unsigned char *>(map);
+  bytes_ = st.st_size;
+  if (!Check(error)) {
+    munmap(map, bytes_);
+    data_ = NULL;
+    bytes_ = 0;
+    header_ = &none_;
+    return false;
+  }
+  index_ = reinterpret_cast<const uint64_t *>(data_ + header_->index);
+  topology_ = Topology::Get(header_->length,
+                            header_->flags & corpus::FLAG_DIAGONAL,
+                            header_->flags & corpus::FLAG_WINDOKU,
+                            vector<string>());
+  if (header_->flags & corpus::FLAG_NUMERIC)
+    symbols_ = Alphabet::Numeric(header_->length);
+  else
+    symbols_ = Alphabet::Get(header_->length, alphabet_);
+  // Codes the cells have room for but the alphabet does not use stay -1.
+  code_syms_.assign(1u << header_->bits, -1);
+  for (int i = 0; i < alphabet_.size(); i++)
+    code_syms_[i + 1] = symbols_->Find(alphabet_[i]);
+  // Records are only touched on demand.
+  madvise(map, bytes_, MADV_RANDOM);
+  return true;
+}
+
+bool Corpus::Check(string *error) {
+  header_ = reinterpret_cast<const corpus::header *>(data_);
+  if (bytes_ < sizeof(corpus::header) ||
+      memcmp(header_->magic, corpus::magic, sizeof(corpus::magic)) != 0) {
+    *error = "not a corpus";
+    return false;
+  }
+  stringstream why;
+  unsigned int length = header_->length;
+  unsigned int root = static_cast<unsigned int>(sqrt(length));
+  bool numeric = header_->flags & corpus::FLAG_NUMERIC;
+  if (header_->version != corpus::version)
+    why << "version " << header_->version << ", not " << corpus::version;
+  else if (length == 0 || root * root != length ||
+           length > symset::capacity ||
+           (!numeric && length > Sudoku::symbols.size()))
+    why << "a side of " << length << " cannot be solved";
+  else if (header_->bits != corpus::CellBits(length))
+    why << header_->bits << " bits per cell for a side of " << length;
+  else if (!numeric && sizeof(corpus::header) + length > bytes_)
+    why << "truncated in the alphabet";
+  else if (header_->index % sizeof(uint64_t) != 0 ||
+           header_->index > bytes_ ||
+           header_->count > (bytes_ - header_->index) / sizeof(uint64_t))
+    why << "truncated in the index";
+  if (!why.str().empty()) {
+    *error = why.str();
+    return false;
+  }
+  alphabet_.clear();
+  if (numeric)
+    alphabet_ = Alphabet::Numeric(length)->tokens();
+  else
+    for (int i = 0; i < length; i++)
+      alphabet_.push_back(string(1, data_[sizeof(corpus::header) + i]));
+  vector<string> distinct (alphabet_);
+  sort(distinct.begin(), distinct.end());
+  if (unique(distinct.begin(), distinct.end()) != distinct.end()) {
+    *error = "its alphabet repeats a symbol";
+    return false;
+  }
+  // Every record must lie in the file, so none is checked when read.
+  const uint64_t *index =
+    reinterpret_cast<const uint64_t *>(data_ + header_->index);
+  size_t record = record_bytes() * (has_solutions() ? 2 : 1);
+  for (uint64_t k = 0; k < header_->count; k++) {
+    if (index[k] > bytes_ || record > bytes_ - index[k]) {
+      why << "record " << k << " lies outside the file";
+      *error = why.str();
+      return false;
+    }
+  }
+  return true;
+}
+
+Corpus::~Corpus() {
+  if (data_)
+    munmap(const_cast<unsigned char *>(data_), bytes_);
+}
+
+size_t Corpus::record_bytes() const {
+  return corpus::PackedBytes(header_->length);
+}
+
+unsigned int Corpus::Get(const unsigned char *rec, unsigned int pos) const {
+  unsigned int bits = header_->bits;
+  unsigned int bit = pos * bits;
+  // A cell spans at most two bytes for any length we can index.
+  unsigned int window = rec[bit / 8];
+  if (bit % 8 + bits > 8)
+    window |= rec[bit / 8 + 1] << 8;
+  return (window >> (bit % 8)) & ((1u << bits) - 1);
+}
+
+void Corpus::Unpack(const unsigned char *rec, unsigned int *codes) const {
+  unsigned int bits = header_->bits;
+  unsigned int mask = (1u << bits) - 1;
+  unsigned int cells = header_->length * header_->length;
+  // Cells are packed low bits first, so shift them out of a running
+  // buffer instead of locating each one.
+  uint64_t buffer = 0;
+  unsigned int held = 0;
+  for (unsigned int pos = 0; pos < cells; pos++) {
+    while (held < bits) {
+      buffer |= static_cast<uint64_t>(*rec++) << held;
+      held += 8;
+    }
+    codes[pos] = buffer & mask;
+    buffer >>= bits;
+    held -= bits;
+  }
+}
+
+tokengrid Corpus::Rows(const unsigned char *rec) const {
+  unsigned int length = header_->length;
+  tokengrid rows (length, vector<string>(length, string(1, Sudoku::unknown)));
+  unsigned int pos = 0;
+  for (int i = 0; i < length; i++) {
+    for (int j = 0; j < length; j++, pos++) {
+      unsigned int code = Get(rec, pos);
+      if (code != 0 && code <= alphabet_.size())
+        rows[i][j] = alphabet_[code - 1];
+    }
+  }
+  return rows;
+}
+
+tokengrid Corpus::GivenRows(size_t k) const {
+  assert(k < size());
+  return Rows(record(k));
+}
+
+tokengrid Corpus::SolutionRows(size_t k) const {
+  assert(k < size() && has_solutions());
+  return Rows(record(k) + record_bytes());
+}
+
+Sudoku Corpus::Puzzle(size_t k) const {
+  return Sudoku(GivenRows(k), topology_);
+}
+
+bool Corpus::Load(size_t k, Sudoku &board) const {
+  assert(k < size());
+  assert(&board.topology() == topology_ && &board.alphabet() == symbols_);
+  const unsigned char *rec = record(k);
+  unsigned int length = header_->length;
+  symset all = symset::All(length);
+  bool valid = true;
+  unsigned int pos = 0;
+  for (int i = 0; i < length; i++) {
+    for (int j = 0; j < length; j++, pos++) {
+      unsigned int code = Get(rec, pos);
+      symset given;
+      if (code == 0)
+        given = all;
+      else if (code_syms_[code] >= 0)
+        given.insert(code_syms_[code]);
+      else
+        valid = false;
+      board.Set(cell(i, j), given);
+    }
+  }
+  return valid;
+}
@@ -0,0 +1,171 @@
+#ifndef __CORPUS_HEADER__
+#define __CORPUS_HEADER__
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "sudoku.h"
+
+// A packed binary collection of puzzles of one size, optionally with their
+// solutions. All integers are stored in host byte order.
+//
+//   header   magic "SDKC", u32 version, u32 length, u32 bits per cell,
+//            u32 flags, u32 reserved, u64 count, u64 index offset,
+//            alphabet (length bytes, zero padded to a multiple of 8)
+//   records  packed givens, then the packed solution if FLAG_SOLUTIONS
+//   index    u64 file offset of each record
+//
+// Cells are stored row-major, ceil(log2(length + 1)) bits each, least
+// significant bit first. Code 0 is an unknown cell and code k is the k-th
+// symbol of the alphabet. Records start on 8-byte boundaries. Corpora with
+// FLAG_NUMERIC use the numbers 1 to length as symbols and store no
+// alphabet.
+namespace corpus {
+
+static const char magic[4] = { 'S', 'D', 'K', 'C' };
+static const uint32_t version = 1;
+static const uint32_t FLAG_SOLUTIONS = 1;
+// Topology variants shared by every puzzle in the corpus.
+static const uint32_t FLAG_DIAGONAL = 2;
+static const uint32_t FLAG_WINDOKU = 4;
+static const uint32_t FLAG_NUMERIC = 8;
+
+struct header {
+  char magic[4];
+  uint32_t version;
+  uint32_t length;
+  uint32_t bits;
+  uint32_t flags;
+  uint32_t reserved;
+  uint64_t count;
+  uint64_t index;
+};
+
+// The number of bits needed to store a cell of a puzzle with this side
+// length.
+unsigned int CellBits(unsigned int length);
+
+// Reads the last fully solved grid from a ToString() dump, such as the
+// .solved files next to the puzzles. Returns false if there is none.
+bool ReadSolvedRows(const std::string &path, unsigned int length,
+                    tokengrid &rows);
+
+}  // namespace corpus
+
+// Streams puzzles into a new corpus file. The header and index are written
+// by Close(), so memory use is one offset per puzzle.
+class CorpusWriter {
+private:
+  std::ofstream out_;
+  const Topology *topology_;
+  unsigned int length_;
+  unsigned int bits_;
+  bool solutions_;
+  std::vector<std::string> alphabet_;
+  std::vector<uint64_t> offsets_;
+  std::vector<unsigned char> record_;
+
+public:
+  // Set 'solutions' if every puzzle added will come with its solution.
+  // Jigsaw regions differ between puzzles, so they cannot be packed.
+  CorpusWriter(const std::string &path, const Topology *topology,
+               bool solutions);
+  ~CorpusWriter();
+
+  // Appends a puzzle given as rows of symbols, as read by
+  // Sudoku::ReadRows(). 'solution' must be non-null iff the writer was
+  // created with solutions.
+  void Add(const tokengrid &givens, const tokengrid *solution);
+  // Writes the header and index. The writer may not be used afterwards.
+  void Close();
+
+  std::size_t size() const { return offsets_.size(); }
+
+private:
+  unsigned int Code(const std::string &sym);
+  void Pack(const tokengrid &rows, std::size_t bytes);
+};
+
+// Read-only view of a corpus file. The file is mapped rather than read, so
+// opening only reads the header and the index, and processes reading the
+// same corpus share its pages.
+class Corpus {
+private:
+  const unsigned char *data_;
+  std::size_t bytes_;
+  // Points at 'none_', an empty corpus, until a file is opened.
+  const corpus::header *header_;
+  corpus::header none_;
+  const uint64_t *index_;
+  std::vector<std::string> alphabet_;
+  const Topology *topology_;
+  const Alphabet *symbols_;
+  // The symbol index of each cell code.
+  std::vector<int> code_syms_;
+
+  Corpus(const Corpus &);
+  Corpus &operator=(const Corpus &);
+
+public:
+  // An empty corpus, until opened.
+  Corpus();
+  ~Corpus();
+
+  // Maps the corpus at 'path', checking its header and that its index
+  // and records lie in the file. Returns false, describing why in
+  // 'error' and leaving the corpus empty, if it cannot be read or is not
+  // a corpus.
+  bool Open(const std::string &path, std::string *error);
+
+  std::size_t size() const { return header_->count; }
+  unsigned int length() const { return header_->length; }
+  bool has_solutions() const { return header_->flags & corpus::FLAG_SOLUTIONS; }
+  const std::vector<std::string> &alphabet() const { return alphabet_; }
+  const Topology *topology() const { return topology_; }
+
+  // Raw cell code of puzzle k; 0 is unknown, otherwise alphabet()[code - 1].
+  // A damaged record may hold codes past the alphabet.
+  unsigned int Given(std::size_t k, unsigned int pos) const {
+    return Get(record(k), pos);
+  }
+  unsigned int Solution(std::size_t k, unsigned int pos) const {
+    return Get(record(k) + record_bytes(), pos);
+  }
+
+  // All the cell codes of puzzle k, row by row, into 'codes', which holds
+  // length() * length() entries.
+  void GivenCodes(std::size_t k, unsigned int *codes) const {
+    Unpack(record(k), codes);
+  }
+  void SolutionCodes(std::size_t k, unsigned int *codes) const {
+    Unpack(record(k) + record_bytes(), codes);
+  }
+
+  // Decodes puzzle k into rows in the text format. Codes past the
+  // alphabet decode as unknown.
+  tokengrid GivenRows(std::size_t k) const;
+  tokengrid SolutionRows(std::size_t k) const;
+  // Builds the board for puzzle k.
+  Sudoku Puzzle(std::size_t k) const;
+  // A board for this corpus with every symbol possible, for Load().
+  Sudoku Board() const { return Sudoku(topology_, symbols_); }
+  // Decodes puzzle k straight into a board from Board(), reusing its
+  // storage. Returns false if a cell holds a code outside the alphabet,
+  // leaving that cell with no candidates.
+  bool Load(std::size_t k, Sudoku &board) const;
+
+private:
+  const unsigned char *record(std::size_t k) const { return data_ + index_[k]; }
+  // Checks the header, alphabet and index of the mapped file, reading
+  // the alphabet.
+  bool Check(std::string *error);
+  std::size_t record_bytes() const;
+  unsigned int Get(const unsigned char *rec, unsigned int pos) const;
+  void Unpack(const unsigned char *rec, unsigned int *codes) const;
+  tokengrid Rows(const unsigned char *rec) const;
+};
+
+#endif // __CORPUS_HEADER__
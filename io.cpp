@@ -0,0 +1,30 @@
+#include <cerrno>
+#include <unistd.h>
+
+#include "io.h"
+
+using namespace std;
+
+bool WriteAll(int fd, const char *data, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = write(fd, data + done, size - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    if (n == 0) {
+      // Nothing written and no error, which write() should not do.
+      errno = EIO;
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+bool Flush(int fd, string &buffer) {
+  bool ok = WriteAll(fd, buffer.data(), buffer.size());
+  buffer.clear();
+  return ok;
+}
@@ -0,0 +1,17 @@
+#ifndef __IO_HEADER__
+#define __IO_HEADER__
+
+#include <cstddef>
+#include <string>
+
+// Writers that batch their output write it out once it holds this much.
+static const std::size_t WRITE_BYTES = 1 << 20;
+
+// Writes all 'size' bytes of 'data' to 'fd', retrying short and
+// interrupted writes. Returns false, with errno set, if a write fails.
+bool WriteAll(int fd, const char *data, std::size_t size);
+
+// Writes all of 'buffer' and empties it, as WriteAll().
+bool Flush(int fd, std::string &buffer);
+
+#endif // __IO_HEADER__
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <list>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+#include "io.h"
+#include "pipeline.h"
+#include "queue.h"
+
+using namespace std;
+
+// Boards in flight per solver thread.
+static const unsigned int BOARDS_PER_THREAD = 4;
+// Puzzles read but not yet written in turn, per solver thread. Bounds the
+// text the writer keeps for puzzles solved ahead of a slow one.
+static const unsigned int WINDOW_PER_THREAD = 256;
+// Sent down the queues in place of a board when a stage is finished.
+static const int FINISHED = -1;
+
+// A board of the pool and the puzzle it holds.
+struct job {
+  size_t k;
+  Sudoku board;
+  // Whether the puzzle held codes outside the corpus alphabet.
+  bool corrupt;
+  solvestatus status;
+  // When the puzzle was read and when it was solved, by Scheduler::Now().
+  double read;
+  double done;
+
+  explicit job(const Sudoku &b)
+    : k(0), board(b), corrupt(false), status(UNSOLVABLE), read(0),
+      done(0) { }
+};
+
+// The pool and the queues of board indices joining the stages.
+struct stages {
+  vector<job> jobs;
+  // Boards free to read into, boards to solve, and boards to write.
+  BoundedQueue<int> free, read, solved;
+  // A ticket per puzzle that may be read before those ahead of it are
+  // written. The reader takes one for each puzzle and the writer gives it
+  // back once the puzzle has had its turn.
+  BoundedQueue<int> tickets;
+
+  stages(const Corpus &puzzles, unsigned int boards, unsigned int threads,
+         unsigned int window)
+    : free(boards + threads), read(boards + threads),
+      solved(boards + threads), tickets(window) {
+    for (int b = 0; b < boards; b++) {
+      jobs.push_back(job(puzzles.Board()));
+      free.Push(b);
+    }
+    for (int t = 0; t < window; t++)
+      tickets.Push(0);
+  }
+};
+
+static void Read(const Corpus &puzzles, size_t first, size_t last,
+                 const batchoptions &opts, stages &st) {
+  for (size_t k = first; k < last; k++) {
+    if (opts.lim.cancel && opts.lim.cancel->load())
+      break;
+    st.tickets.Pop();
+    int b = st.free.Pop();
+    st.jobs[b].k = k;
+    st.jobs[b].corrupt = !puzzles.Load(k, st.jobs[b].board);
+    st.jobs[b].read = Scheduler::Now();
+    st.read.Push(b);
+  }
+  for (int t = 0; t < opts.threads; t++)
+    st.read.Push(FINISHED);
+}
+
+static context Context(const batchoptions &opts, Scheduler *scheduler,
+                       Budget *budget) {
+  context ctx;
+  ctx.budget = budget;
+  ctx.scheduler = scheduler;
+  ctx.probe = opts.probe;
+  ctx.trace = opts.trace;
+  ctx.templates = opts.templates;
+  return ctx;
+}
+
+// A puzzle a solver thread is searching, taking turns with others.
+struct turn {
+  int b;
+  Budget budget;
+  Search search;
+
+  turn(int b, job &j, const batchoptions &opts, Scheduler *scheduler)
+    : b(b), budget(opts.lim),
+      search(j.board, Context(opts, scheduler, &budget)) { }
+};
+
+static void Done(stages &st, int b, solvestatus status) {
+  job &j = st.jobs[b];
+  j.status = status;
+  j.done = Scheduler::Now();
+  st.solved.Push(b);
+}
+
+// Solves a puzzle without taking turns.
+static void SolveWhole(const batchoptions &opts, Scheduler *scheduler,
+                       stages &st, int b) {
+  job &j = st.jobs[b];
+  Budget budget (opts.lim);
+  context ctx = Context(opts, scheduler, &budget);
+  randomsearch search;
+  if (opts.randomized) {
+    search = *opts.randomized;
+    search.seed += j.k;
+    ctx.randomized = &search;
+  }
+  if (opts.trace)
+    opts.trace->Begin("puzzle", "index", j.k);
+  solvestatus status = Solve(j.board, opts.logic, ctx);
+  if (opts.trace)
+    opts.trace->End("puzzle");
+  Done(st, b, status);
+}
+
+static void Work(const batchoptions &opts, Scheduler *scheduler,
+                 stages &st) {
+  bool interleaved = opts.interleave > 1 && !opts.logic &&
+    !opts.randomized && !opts.trace;
+  list<turn> turns;
+  for (bool more = true; more || !turns.empty(); ) {
+    // Waits for a puzzle only when there is nothing else to search.
+    while (more && (turns.empty() || turns.size() < opts.interleave)) {
+      int b;
+      if (turns.empty())
+        b = st.read.Pop();
+      else if (!st.read.TryPop(b))
+        break;
+      if (b == FINISHED)
+        more = false;
+      else if (!interleaved)
+        SolveWhole(opts, scheduler, st, b);
+      else
+        turns.emplace_back(b, st.jobs[b], opts, scheduler);
+    }
+    for (list<turn>::iterator t = turns.begin(); t != turns.end(); ) {
+      if (!t->search.Run(opts.slice)) {
+        ++t;
+        continue;
+      }
+      Done(st, t->b, t->search.status());
+      t = turns.erase(t);
+    }
+  }
+  st.solved.Push(FINISHED);
+}
+
+static void Write(size_t first, const batchoptions &opts, int fd,
+                  stages &st, batchresult &result) {
+  // The text of boards that finished ahead of their turn, by index. Their
+  // boards go back to the pool at once, so that a puzzle searched for
+  // long does not hold up the reading of those after it; the tickets
+  // bound how many wait here.
+  boost::unordered_map<size_t, string> waiting;
+  vector<double> micros;
+  string buffer;
+  buffer.reserve(2 * WRITE_BYTES);
+  size_t next = first;
+  for (unsigned int running = opts.threads; running > 0; ) {
+    int b = st.solved.Pop();
+    if (b == FINISHED) {
+      running--;
+      continue;
+    }
+    job &j = st.jobs[b];
+    if (opts.outcomes) {
+      unsigned char none = OUTCOME_NONE;
+      unsigned char now = j.status == TIMED_OUT ? OUTCOME_TIMED_OUT :
+        j.board.Solved() ? OUTCOME_SOLVED : OUTCOME_FAILED;
+      opts.outcomes[j.k].compare_exchange_strong(none, now);
+    }
+    micros.push_back(j.done - j.read);
+    result.written++;
+    result.solved += j.board.Solved();
+    result.timed_out += j.status == TIMED_OUT;
+    result.corrupt += j.corrupt;
+    string &text = j.k == next ? buffer : waiting[j.k];
+    if (fd >= 0) {
+      char label[32];
+      snprintf(label, sizeof(label), "#%lu", static_cast<unsigned long>(j.k));
+      text += label;
+      j.board.AppendTo(text);
+      text += j.corrupt ? "Corrupt" : Outcome(j.board, j.status);
+      text += '\n';
+    }
+    bool turn = j.k == next;
+    st.free.Push(b);
+    if (!turn)
+      continue;
+    for (next++, st.tickets.Push(0); ; next++, st.tickets.Push(0)) {
+      boost::unordered_map<size_t, string>::iterator w = waiting.find(next);
+      if (w == waiting.end())
+        break;
+      buffer += w->second;
+      waiting.erase(w);
+    }
+    if (fd >= 0 && buffer.size() >= WRITE_BYTES && !Flush(fd, buffer)) {
+      // Counts the rest without writing it.
+      result.error = errno;
+      fd = -1;
+    }
+    if (fd < 0)
+      buffer.clear();
+  }
+  if (fd >= 0 && !Flush(fd, buffer))
+    result.error = errno;
+  if (!micros.empty()) {
+    sort(micros.begin(), micros.end());
+    result.p50_micros = micros[(micros.size() - 1) / 2];
+    result.p99_micros = micros[(micros.size() - 1) * 99 / 100];
+  }
+}
+
+batchresult SolveBatch(const Corpus &puzzles, size_t first, size_t last,
+                       const batchoptions &opts, int fd) {
+  assert(opts.threads > 0);
+  unsigned int boards = (BOARDS_PER_THREAD + opts.interleave) * opts.threads;
+  stages st (puzzles, boards, opts.threads,
+             max(boards, WINDOW_PER_THREAD * opts.threads));
+  vector<Scheduler> schedulers;
+  if (opts.scheduler)
+    schedulers.assign(opts.threads, *opts.scheduler);
+  batchresult result;
+  vector<thread> threads;
+  threads.push_back(thread(Read, ref(puzzles), first, last, ref(opts),
+                           ref(st)));
+  for (int t = 0; t < opts.threads; t++)
+    threads.push_back(thread(Work, ref(opts),
+                             opts.scheduler ? &schedulers[t] : NULL,
+                             ref(st)));
+  threads.push_back(thread(Write, first, ref(opts), fd, ref(st),
+                           ref(result)));
+  for (int t = 0; t < threads.size(); t++)
+    threads[t].join();
+  if (opts.scheduler) {
+    Scheduler origin = *opts.scheduler;
+    for (int t = 0; t < schedulers.size(); t++)
+      opts.scheduler->Merge(schedulers[t], origin);
+  }
+  return result;
+}
@@ -0,0 +1,94 @@
+#ifndef __PIPELINE_HEADER__
+#define __PIPELINE_HEADER__
+
+#include <atomic>
+#include <cstddef>
+
+#include "corpus.h"
+#include "scheduler.h"
+#include "solve.h"
+
+// What became of a puzzle, as recorded in batchoptions::outcomes.
+enum outcome {
+  OUTCOME_NONE,
+  OUTCOME_SOLVED,
+  // Found to have no solution, or left unsolved by logic alone.
+  OUTCOME_FAILED,
+  OUTCOME_TIMED_OUT
+};
+
+// How to solve a batch of puzzles.
+struct batchoptions {
+  // Use LogicSolve alone rather than GuessSolve.
+  bool logic;
+  // Applied to each puzzle. Cancelling also stops the batch reading more.
+  limits lim;
+  // Solver threads. The reader and the writer have a thread each besides.
+  unsigned int threads;
+  // Puzzles each solver thread searches at once, taking turns of 'slice'
+  // nodes, so that easy puzzles are not held up behind hard ones. Logic
+  // alone and randomized searches are not interleaved, and neither is
+  // anything when tracing, as spans must nest on each thread.
+  unsigned int interleave;
+  unsigned long slice;
+  // Cells to probe before each guess; see Probe(). Each solver thread
+  // probes on its own.
+  unsigned int probe;
+  // Runs the TEMPLATE strategy; see context::templates.
+  bool templates;
+  // Optional. Puzzle k is searched at random with this policy, seeded
+  // with its seed plus k, so runs are reproducible whatever the threads.
+  const randomsearch *randomized;
+  // Optional. Each solver thread schedules with its own copy, and what
+  // they learn is merged back into it at the end.
+  Scheduler *scheduler;
+  // Optional. Each puzzle is traced as a span on its solver's thread.
+  Tracer *trace;
+  // Optional, indexed by corpus position. The outcome of each puzzle is
+  // stored as it is written, unless one is there already, so several
+  // batches can share a table, even across processes.
+  std::atomic<unsigned char> *outcomes;
+
+  batchoptions()
+    : logic(false), threads(1), interleave(1), slice(32), probe(0),
+      templates(false), randomized(NULL), scheduler(NULL), trace(NULL),
+      outcomes(NULL) { }
+};
+
+struct batchresult {
+  std::size_t written;
+  std::size_t solved;
+  std::size_t timed_out;
+  // Puzzles whose records held codes outside the alphabet, which are
+  // written as "Corrupt" and fail to solve.
+  std::size_t corrupt;
+  // Percentiles of the time from the reading of each puzzle to its
+  // solving, waiting for a solver thread included.
+  double p50_micros;
+  double p99_micros;
+  // The errno of a failed write to the output, after which the rest of
+  // the batch was only counted, or 0.
+  int error;
+
+  batchresult()
+    : written(0), solved(0), timed_out(0), corrupt(0), p50_micros(0),
+      p99_micros(0), error(0) { }
+};
+
+// Solves puzzles first to last - 1 of a corpus as a pipeline: a reader
+// thread decodes puzzles into a fixed pool of boards, a pool of solver
+// threads solves them, and a writer thread formats each as "#k", its
+// board and its outcome into one buffer that it writes to 'fd' in large
+// blocks. Boards are written in corpus order, or only counted if 'fd' is
+// negative. The stages are joined by
+// bounded lock-free queues, so at most a few boards per solver are in
+// flight however large the corpus. The reader stays at most a few
+// hundred puzzles per solver ahead of the writer, which bounds the text
+// kept for puzzles solved ahead of a slow one.
+//
+// Topology and alphabet lookups are not thread-safe; the pool of boards is
+// built before any thread starts and solving never looks them up.
+batchresult SolveBatch(const Corpus &puzzles, std::size_t first,
+                       std::size_t last, const batchoptions &opts, int fd);
+
+#endif // __PIPELINE_HEADER__
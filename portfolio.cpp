@@ -0,0 +1,117 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "portfolio.h"
+
+using namespace std;
+
+// How often the race checks for the caller cancelling it.
+static const chrono::milliseconds POLL (10);
+
+vector<config> DefaultPortfolio() {
+  vector<config> configs;
+  configs.push_back(config("fixed", false, 0, FEWEST));
+  configs.push_back(config("adaptive", true, 0, FEWEST));
+  configs.push_back(config("busiest", false, 0, FEWEST_BUSIEST));
+  configs.push_back(config("probe", false, 8, FEWEST));
+  return configs;
+}
+
+// The state of a race, shared by its entrants.
+struct race {
+  // Set to cancel every entrant.
+  atomic<bool> stop;
+  atomic<int> winner;
+  mutex lock;
+  condition_variable finished;
+  unsigned int running;
+
+  explicit race(unsigned int entrants)
+    : stop(false), winner(-1), running(entrants) { }
+};
+
+// One configuration racing on its own board.
+struct entrant {
+  Sudoku board;
+  Scheduler scheduler;
+  solvestatus status;
+
+  entrant(const Sudoku &board, const Scheduler &scheduler)
+    : board(board), scheduler(scheduler), status(TIMED_OUT) { }
+};
+
+static void Run(const config &cfg, int index, const limits &lim,
+                bool scheduled, Tracer *trace, entrant &e, race &r) {
+  limits own = lim;
+  own.cancel = &r.stop;
+  Budget budget (own);
+  context ctx;
+  ctx.budget = &budget;
+  ctx.scheduler = scheduled ? &e.scheduler : NULL;
+  ctx.probe = cfg.probe;
+  ctx.branch = cfg.branch;
+  ctx.trace = trace;
+  if (trace)
+    trace->Begin("entrant", "config", index);
+  e.status = Solve(e.board, false, ctx);
+  if (trace)
+    trace->End("entrant");
+  int none = -1;
+  if (e.status != TIMED_OUT && r.winner.compare_exchange_strong(none, index))
+    r.stop.store(true);
+  lock_guard<mutex> hold (r.lock);
+  r.running--;
+  r.finished.notify_one();
+}
+
+portfolioresult SolvePortfolio(Sudoku &board, const vector<config> &configs,
+                               const limits &lim, Scheduler *scheduler,
+                               Tracer *trace) {
+  assert(!configs.empty());
+  vector<entrant> entrants;
+  for (int k = 0; k < configs.size(); k++) {
+    // Configurations that are not adaptive only need a scheduler to
+    // record into the caller's.
+    Scheduler own (configs[k].adaptive);
+    if (scheduler)
+      own.Merge(*scheduler, Scheduler(false));
+    entrants.push_back(entrant(board.Clone(), own));
+  }
+  vector<Scheduler> origins;
+  for (int k = 0; k < entrants.size(); k++)
+    origins.push_back(entrants[k].scheduler);
+  race r (configs.size());
+  vector<thread> threads;
+  for (int k = 0; k < configs.size(); k++)
+    threads.push_back(thread(Run, cref(configs[k]), k, cref(lim),
+                             scheduler != NULL || configs[k].adaptive,
+                             trace, ref(entrants[k]), ref(r)));
+  {
+    unique_lock<mutex> hold (r.lock);
+    while (r.running > 0) {
+      r.finished.wait_for(hold, POLL);
+      if (lim.cancel && lim.cancel->load())
+        r.stop.store(true);
+    }
+  }
+  for (int k = 0; k < threads.size(); k++)
+    threads[k].join();
+
+  portfolioresult result;
+  result.winner = r.winner.load();
+  const entrant &first = entrants[max(result.winner, 0)];
+  result.status = first.status;
+  board.CopyFrom(first.board);
+  if (scheduler) {
+    for (int k = 0; k < entrants.size(); k++)
+      scheduler->Merge(entrants[k].scheduler, origins[k]);
+    if (result.winner >= 0)
+      scheduler->RecordWin(board.length(), configs[result.winner].name);
+  }
+  return result;
+}
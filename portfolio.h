@@ -0,0 +1,51 @@
+#ifndef __PORTFOLIO_HEADER__
+#define __PORTFOLIO_HEADER__
+
+#include <string>
+#include <vector>
+
+#include "scheduler.h"
+#include "solve.h"
+#include "sudoku.h"
+
+// One way of solving a puzzle, as raced by SolvePortfolio().
+struct config {
+  std::string name;
+  // Schedule strategies adaptively rather than in the fixed order.
+  bool adaptive;
+  // Cells to probe before each guess; see Probe().
+  unsigned int probe;
+  branching branch;
+
+  config(const std::string &name, bool adaptive, unsigned int probe,
+         branching branch)
+    : name(name), adaptive(adaptive), probe(probe), branch(branch) { }
+};
+
+// The configurations raced by default.
+std::vector<config> DefaultPortfolio();
+
+struct portfolioresult {
+  solvestatus status;
+  // The index of the configuration that finished first, or -1 if every
+  // one timed out.
+  int winner;
+
+  portfolioresult() : status(TIMED_OUT), winner(-1) { }
+};
+
+// Solves the puzzle with every configuration at once, one thread each, on
+// copies of the board. The first to solve the puzzle, or to prove it has
+// no solution, wins and the others are cancelled; the board is left as
+// the winner's. 'lim' applies to each configuration, and cancelling it
+// cancels them all.
+//
+// If 'scheduler' is given, each configuration schedules with its own copy,
+// what they learn is merged back into it, and it counts the win. If
+// 'trace' is given, each configuration is traced on its own thread.
+portfolioresult SolvePortfolio(Sudoku &board,
+                               const std::vector<config> &configs,
+                               const limits &lim, Scheduler *scheduler,
+                               Tracer *trace = NULL);
+
+#endif // __PORTFOLIO_HEADER__
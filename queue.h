@@ -0,0 +1,116 @@
+#ifndef __QUEUE_HEADER__
+#define __QUEUE_HEADER__
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// A bounded multi-producer multi-consumer queue over a ring of slots, each
+// stamped with the turn it is next ready for (Vyukov's design). Producers
+// and consumers only contend on their own end's counter, and never take
+// a lock. The capacity is rounded up to a power of two.
+template <typename T>
+class BoundedQueue {
+private:
+  struct slot {
+    std::atomic<std::size_t> turn;
+    T value;
+  };
+
+  std::vector<slot> slots_;
+  std::size_t mask_;
+  // Kept on separate cache lines so producers and consumers do not
+  // invalidate each other's counter.
+  alignas(64) std::atomic<std::size_t> head_;
+  alignas(64) std::atomic<std::size_t> tail_;
+
+  BoundedQueue(const BoundedQueue &);
+  BoundedQueue &operator=(const BoundedQueue &);
+
+public:
+  explicit BoundedQueue(std::size_t capacity) : head_(0), tail_(0) {
+    std::size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    slots_ = std::vector<slot>(size);
+    mask_ = size - 1;
+    for (std::size_t i = 0; i < size; i++)
+      slots_[i].turn.store(i, std::memory_order_relaxed);
+  }
+
+  std::size_t capacity() const { return slots_.size(); }
+
+  // Returns false if the queue is full.
+  bool TryPush(const T &value) {
+    std::size_t pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      slot &s = slots_[pos & mask_];
+      std::ptrdiff_t diff = s.turn.load(std::memory_order_acquire) - pos;
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          s.value = value;
+          s.turn.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0) {
+        return false;
+      }
+      else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Returns false if the queue is empty.
+  bool TryPop(T &value) {
+    std::size_t pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      slot &s = slots_[pos & mask_];
+      std::ptrdiff_t diff =
+        s.turn.load(std::memory_order_acquire) - (pos + 1);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          value = s.value;
+          s.turn.store(pos + mask_ + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0) {
+        return false;
+      }
+      else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Blocking versions, which spin briefly and then back off to sleeping
+  // so that idle stages leave the cores to the solvers.
+  void Push(const T &value) {
+    for (unsigned int tries = 0; !TryPush(value); tries++)
+      Wait(tries);
+  }
+  T Pop() {
+    T value;
+    for (unsigned int tries = 0; !TryPop(value); tries++)
+      Wait(tries);
+    return value;
+  }
+
+private:
+  static void Wait(unsigned int tries) {
+    if (tries < 64)
+      return;
+    if (tries < 128)
+      std::this_thread::yield();
+    else
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+};
+
+#endif // __QUEUE_HEADER__
@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <time.h>
+
+#include "scheduler.h"
+
+using namespace std;
+
+// Calls before a strategy's record is trusted.
+static const unsigned long WARMUP = 8;
+// Strategies earning less than this fraction of the best one are demoted.
+static const double DEMOTE_RATIO = 1.0 / 32;
+// Demoted strategies run once every this many rounds.
+static const unsigned int DEMOTE_PERIOD = 8;
+// Subset sizes making less than this fraction of the eliminations are not
+// searched, beyond one size past the largest that pays.
+static const double SIZE_RATIO = 0.01;
+// Rounds earning less than this fraction of the best strategy are
+// abandoned in favour of guessing.
+static const double ABANDON_RATIO = 1.0 / 16;
+
+// Whether a strategy takes part in warming up, demotion and the printed
+// record. Optional strategies only do once they have run.
+static bool Counts(const vector<strategystats> &prof, int s) {
+  return s < TEMPLATE || prof[s].calls > 0;
+}
+
+Scheduler::Scheduler(bool adaptive)
+  : adaptive_(adaptive), skipped_(NUM_STRATEGIES, 0) { }
+
+const char *Scheduler::Name(strategy s) {
+  switch (s) {
+  case INTERSECTION:
+    return "intersection";
+  case HIDDEN:
+    return "hidden";
+  case NAKED:
+    return "naked";
+  case FISH:
+    return "fish";
+  case COLORING:
+    return "coloring";
+  case X_CHAIN:
+    return "x-chain";
+  case XY_CHAIN:
+    return "xy-chain";
+  case AIC:
+    return "aic";
+  case TEMPLATE:
+    return "template";
+  case NUM_STRATEGIES:
+    break;
+  }
+  return "";
+}
+
+double Scheduler::Now() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+vector<strategystats> &Scheduler::profile(unsigned int length) {
+  vector<strategystats> &prof = profiles_[length];
+  if (prof.empty())
+    prof.resize(NUM_STRATEGIES);
+  return prof;
+}
+
+// Orders strategies by decreasing yield.
+class higher_yield {
+private:
+  const vector<strategystats> &prof_;
+public:
+  higher_yield(const vector<strategystats> &prof) : prof_(prof) { }
+  bool operator()(strategy s1, strategy s2) const {
+    return prof_[s1].yield() > prof_[s2].yield();
+  }
+};
+
+vector<strategy> Scheduler::Order(unsigned int length) {
+  vector<strategy> order;
+  for (int s = 0; s < NUM_STRATEGIES; s++)
+    order.push_back(static_cast<strategy>(s));
+  if (!adaptive_)
+    return order;
+  const vector<strategystats> &prof = profile(length);
+  double best = 0;
+  bool warm = true;
+  for (int s = 0; s < NUM_STRATEGIES; s++) {
+    if (!Counts(prof, s))
+      continue;
+    best = max(best, prof[s].yield());
+    warm = warm && prof[s].calls >= WARMUP;
+  }
+  if (!warm)
+    return order;
+  stable_sort(order.begin(), order.end(), higher_yield(prof));
+  vector<strategy> run;
+  for (int i = 0; i < order.size(); i++) {
+    strategy s = order[i];
+    if (prof[s].yield() < best * DEMOTE_RATIO &&
+        ++skipped_[s] < DEMOTE_PERIOD)
+      continue;
+    skipped_[s] = 0;
+    run.push_back(s);
+  }
+  return run;
+}
+
+unsigned int Scheduler::MaxSize(strategy s, unsigned int length,
+                                unsigned int blocksize) const {
+  boost::unordered_map<unsigned int, vector<strategystats> >::const_iterator
+    it = profiles_.find(length);
+  if (!adaptive_ || it == profiles_.end() || it->second[s].calls < WARMUP)
+    return blocksize;
+  const strategystats &st = it->second[s];
+  unsigned int largest = 1;
+  for (unsigned int k = 1; k < st.by_size.size(); k++)
+    if (st.by_size[k] > 0 && st.by_size[k] >= st.eliminations * SIZE_RATIO)
+      largest = k;
+  return min(blocksize, max(2u, largest + 1));
+}
+
+bool Scheduler::Abandon(unsigned int length, unsigned long eliminations,
+                        double micros) const {
+  boost::unordered_map<unsigned int, vector<strategystats> >::const_iterator
+    it = profiles_.find(length);
+  if (!adaptive_ || it == profiles_.end())
+    return false;
+  double best = 0;
+  for (int s = 0; s < NUM_STRATEGIES; s++) {
+    if (!Counts(it->second, s))
+      continue;
+    if (it->second[s].calls < WARMUP)
+      return false;
+    best = max(best, it->second[s].yield());
+  }
+  return eliminations / (micros + 1) < best * ABANDON_RATIO;
+}
+
+void Scheduler::Record(strategy s, unsigned int length, double micros,
+                       const vector<unsigned long> &by_size) {
+  strategystats &st = profile(length)[s];
+  st.calls++;
+  st.micros += micros;
+  if (st.by_size.size() < by_size.size())
+    st.by_size.resize(by_size.size());
+  for (int k = 0; k < by_size.size(); k++) {
+    st.by_size[k] += by_size[k];
+    st.eliminations += by_size[k];
+  }
+}
+
+// One line per board size and strategy:
+//   length name calls micros eliminations sizes by_size...
+// and one per board size and portfolio configuration that has won:
+//   length win configuration wins
+bool Scheduler::Load(const string &path) {
+  ifstream in (path.c_str(), ifstream::in);
+  if (!in.good())
+    return false;
+  string line;
+  while (getline(in, line)) {
+    stringstream fields (line);
+    unsigned int length, sizes;
+    string name;
+    if (!(fields >> length >> name))
+      continue;
+    if (name == "win") {
+      string config;
+      unsigned long wins;
+      if (fields >> config >> wins)
+        wins_[length][config] += wins;
+      continue;
+    }
+    strategystats loaded;
+    if (!(fields >> loaded.calls >> loaded.micros
+          >> loaded.eliminations >> sizes))
+      continue;
+    loaded.by_size.resize(sizes);
+    for (int k = 0; k < sizes; k++)
+      fields >> loaded.by_size[k];
+    for (int s = 0; s < NUM_STRATEGIES; s++)
+      if (name == Name(static_cast<strategy>(s)))
+        Add(static_cast<strategy>(s), length, loaded);
+  }
+  return true;
+}
+
+void Scheduler::RecordWin(unsigned int length, const string &name) {
+  wins_[length][name]++;
+}
+
+void Scheduler::Add(strategy s, unsigned int length,
+                    const strategystats &from) {
+  strategystats &st = profile(length)[s];
+  st.calls += from.calls;
+  st.micros += from.micros;
+  st.eliminations += from.eliminations;
+  if (st.by_size.size() < from.by_size.size())
+    st.by_size.resize(from.by_size.size());
+  for (int k = 0; k < from.by_size.size(); k++)
+    st.by_size[k] += from.by_size[k];
+}
+
+void Scheduler::Merge(const Scheduler &other, const Scheduler &origin) {
+  for (boost::unordered_map<unsigned int, vector<strategystats> >::
+         const_iterator it = other.profiles_.begin();
+       it != other.profiles_.end(); ++it) {
+    boost::unordered_map<unsigned int, vector<strategystats> >::
+      const_iterator old = origin.profiles_.find(it->first);
+    for (int s = 0; s < NUM_STRATEGIES; s++) {
+      strategystats delta = it->second[s];
+      if (old != origin.profiles_.end()) {
+        const strategystats &before = old->second[s];
+        delta.calls -= before.calls;
+        delta.micros -= before.micros;
+        delta.eliminations -= before.eliminations;
+        for (int k = 0; k < before.by_size.size(); k++)
+          delta.by_size[k] -= before.by_size[k];
+      }
+      Add(static_cast<strategy>(s), it->first, delta);
+    }
+  }
+  for (boost::unordered_map<unsigned int, tally>::const_iterator
+         it = other.wins_.begin(); it != other.wins_.end(); ++it) {
+    boost::unordered_map<unsigned int, tally>::const_iterator old =
+      origin.wins_.find(it->first);
+    for (tally::const_iterator w = it->second.begin();
+         w != it->second.end(); ++w) {
+      wins_[it->first][w->first] += w->second;
+      if (old != origin.wins_.end() && old->second.count(w->first))
+        wins_[it->first][w->first] -= old->second.find(w->first)->second;
+    }
+  }
+}
+
+bool Scheduler::Save(const string &path) const {
+  ofstream out (path.c_str(), ofstream::out | ofstream::trunc);
+  for (boost::unordered_map<unsigned int, vector<strategystats> >::
+         const_iterator it = profiles_.begin(); it != profiles_.end(); ++it) {
+    for (int s = 0; s < NUM_STRATEGIES; s++) {
+      if (!Counts(it->second, s))
+        continue;
+      const strategystats &st = it->second[s];
+      out << it->first << ' ' << Name(static_cast<strategy>(s)) << ' '
+          << st.calls << ' ' << fixed << setprecision(0) << st.micros << ' '
+          << st.eliminations << ' ' << st.by_size.size();
+      for (int k = 0; k < st.by_size.size(); k++)
+        out << ' ' << st.by_size[k];
+      out << '\n';
+    }
+  }
+  for (boost::unordered_map<unsigned int, tally>::const_iterator
+         it = wins_.begin(); it != wins_.end(); ++it)
+    for (tally::const_iterator w = it->second.begin();
+         w != it->second.end(); ++w)
+      out << it->first << " win " << w->first << ' ' << w->second << '\n';
+  return out.good();
+}
+
+void Scheduler::Print(ostream &out) const {
+  for (boost::unordered_map<unsigned int, vector<strategystats> >::
+         const_iterator it = profiles_.begin(); it != profiles_.end(); ++it) {
+    out << "Strategy costs, " << it->first << 'x' << it->first << ":\n";
+    for (int s = 0; s < NUM_STRATEGIES; s++) {
+      if (!Counts(it->second, s))
+        continue;
+      const strategystats &st = it->second[s];
+      out << "  " << left << setw(8) << Name(static_cast<strategy>(s))
+          << right << " calls " << setw(7) << st.calls
+          << "  time " << fixed << setprecision(1) << setw(9)
+          << st.micros / 1000 << "ms  eliminated " << setw(8)
+          << st.eliminations << "  per us " << setprecision(3)
+          << st.yield() << '\n';
+      // Strategies without a size only fill entry 0, the total above.
+      if (st.by_size.empty() || st.eliminations == st.by_size[0])
+        continue;
+      out << "           by size:";
+      for (int k = 1; k < st.by_size.size(); k++)
+        if (st.by_size[k] > 0)
+          out << ' ' << k << '=' << st.by_size[k];
+      out << '\n';
+    }
+  }
+  for (boost::unordered_map<unsigned int, tally>::const_iterator
+         it = wins_.begin(); it != wins_.end(); ++it) {
+    out << "Portfolio wins, " << it->first << 'x' << it->first << ':';
+    for (tally::const_iterator w = it->second.begin();
+         w != it->second.end(); ++w)
+      out << ' ' << w->first << '=' << w->second;
+    out << '\n';
+  }
+  out.unsetf(ios::floatfield);
+}
@@ -0,0 +1,101 @@
+#ifndef __SCHEDULER_HEADER__
+#define __SCHEDULER_HEADER__
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+// The deduction strategies LogicSolve can schedule.
+enum strategy {
+  INTERSECTION,
+  HIDDEN,
+  NAKED,
+  FISH,
+  COLORING,
+  X_CHAIN,
+  XY_CHAIN,
+  AIC,
+  // Optional, run only when context::templates asks for it.
+  TEMPLATE,
+  NUM_STRATEGIES
+};
+
+// What one strategy has cost and earned on boards of one size.
+struct strategystats {
+  unsigned long calls;
+  double micros;
+  unsigned long eliminations;
+  // Eliminations by the size of the subset, or fish, that made them.
+  // Index 0 counts symbols removed by strategies without a size:
+  // intersections, coloring and chains.
+  std::vector<unsigned long> by_size;
+
+  strategystats() : calls(0), micros(0), eliminations(0) { }
+  // Eliminations per microsecond.
+  double yield() const { return eliminations / (micros + 1); }
+};
+
+// Decides which strategies LogicSolve runs, in what order and with what
+// subset size, from what they have paid off so far. Profiles are kept
+// per board size and can be saved and reloaded between runs.
+//
+// A scheduler that is not adaptive only records, so the fixed strategy
+// order can be profiled too. Schedulers are not thread-safe.
+class Scheduler {
+private:
+  bool adaptive_;
+  boost::unordered_map<unsigned int, std::vector<strategystats> > profiles_;
+  // Rounds each strategy has been passed over since it last ran.
+  std::vector<unsigned int> skipped_;
+  // Portfolio races won, by board size and configuration.
+  typedef boost::unordered_map<std::string, unsigned long> tally;
+  boost::unordered_map<unsigned int, tally> wins_;
+
+public:
+  explicit Scheduler(bool adaptive);
+
+  bool adaptive() const { return adaptive_; }
+
+  // Reads a profile written by Save(), merging it into this one. Returns
+  // false if the file cannot be read.
+  bool Load(const std::string &path);
+  bool Save(const std::string &path) const;
+  // Adds what 'other' recorded after it was copied from 'origin', so the
+  // schedulers of worker threads can be folded back into one.
+  void Merge(const Scheduler &other, const Scheduler &origin);
+
+  // The strategies worth running this round on a board of this size, in
+  // decreasing order of payoff. Demoted strategies are only included
+  // every few rounds.
+  std::vector<strategy> Order(unsigned int length);
+  // The largest subset size worth searching for.
+  unsigned int MaxSize(strategy s, unsigned int length,
+                       unsigned int blocksize) const;
+  // Whether a round of logic that removed 'eliminations' candidates in
+  // 'micros' paid off too little to continue rather than guess.
+  bool Abandon(unsigned int length, unsigned long eliminations,
+               double micros) const;
+
+  void Record(strategy s, unsigned int length, double micros,
+              const std::vector<unsigned long> &by_size);
+  const strategystats &stats(strategy s, unsigned int length) {
+    return profile(length)[s];
+  }
+  // Counts a portfolio race won by configuration 'name'.
+  void RecordWin(unsigned int length, const std::string &name);
+
+  // Per-strategy costs and portfolio wins for every board size seen.
+  void Print(std::ostream &out) const;
+
+  static const char *Name(strategy s);
+  // Microseconds on a monotonic clock.
+  static double Now();
+
+private:
+  std::vector<strategystats> &profile(unsigned int length);
+  // Adds 'from' to the record of 's' on boards of this size.
+  void Add(strategy s, unsigned int length, const strategystats &from);
+};
+
+#endif // __SCHEDULER_HEADER__
@@ -0,0 +1,179 @@
+#include <utility>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+#include "scheduler.h"
+#include "session.h"
+#include "solve.h"
+
+using namespace std;
+
+// The largest fish NextStep() looks for.
+static const unsigned int MAX_HINT_FISH = 3;
+
+Session::Session(const Sudoku &puzzle)
+  : board_(puzzle.Clone()), scratch_(puzzle.Clone()) {
+  unsigned int length = board_.length();
+  for (unsigned int x = 0; x < length * length; x++)
+    given_.push_back(board_[x / length][x % length].single());
+  filled_ = given_;
+  valid_ = AC3(board_);
+  board_.Track(&log_);
+  scratch_.Track(&scratch_log_);
+}
+
+int Session::Find(const cell &c) const {
+  for (int k = 0; k < placed_.size(); k++)
+    if (placed_[k].c == c)
+      return k;
+  return -1;
+}
+
+// Restricts 'c' to 'sym' and propagates from it. Returns false if that
+// empties a cell.
+static bool Assign(Sudoku &board, const cell &c, int sym) {
+  symset only;
+  only.insert(sym);
+  board.Restrict(c, only);
+  return AC3(board, c);
+}
+
+bool Session::Propagate(const cell &c, int sym) {
+  size_t mark = log_.size();
+  if (!Assign(board_, c, sym)) {
+    board_.Undo(mark);
+    return false;
+  }
+  placement p = { c, sym, mark };
+  placed_.push_back(p);
+  filled_[board_.topology().index(c)] = true;
+  return true;
+}
+
+void Session::Replay(size_t k, size_t mark) {
+  vector<placement> again (placed_.begin() + k, placed_.end());
+  board_.Undo(mark);
+  placed_.resize(k);
+  // AC3 reaches the same board whatever the order of the placements, and
+  // only removes more with more of them, so a placement that held still
+  // holds without one before it, or once one is replaced by a placement
+  // Consistent() accepts. Were one not to, it is dropped.
+  for (vector<placement>::const_iterator p = again.begin();
+       p != again.end(); ++p) {
+    if (!Propagate(p->c, p->sym))
+      filled_[board_.topology().index(p->c)] = false;
+  }
+}
+
+bool Session::Place(const cell &c, int sym) {
+  if (!valid_ || given_[board_.topology().index(c)])
+    return false;
+  int k = Find(c);
+  if (k < 0)
+    return Propagate(c, sym);
+  if (placed_[k].sym == sym)
+    return true;
+  if (!Consistent(c, sym))
+    return false;
+  // Keeps its place in the order, so only those after it are replayed.
+  placed_[k].sym = sym;
+  Replay(k, placed_[k].mark);
+  return true;
+}
+
+bool Session::Clear(const cell &c) {
+  int k = Find(c);
+  if (k < 0)
+    return false;
+  size_t mark = placed_[k].mark;
+  placed_.erase(placed_.begin() + k);
+  filled_[board_.topology().index(c)] = false;
+  Replay(k, mark);
+  return true;
+}
+
+bool Session::Consistent(const cell &c, int sym) {
+  if (!valid_ || given_[board_.topology().index(c)])
+    return false;
+  int k = Find(c);
+  if (k < 0) {
+    size_t mark = log_.size();
+    bool consistent = Assign(board_, c, sym);
+    board_.Undo(mark);
+    return consistent;
+  }
+  if (placed_[k].sym == sym)
+    return true;
+  // Tried on scratch_, taken back to before the placement in 'c' by
+  // undoing a copy of the trail, so the board and the order of the
+  // placements are left alone.
+  scratch_.CopyFrom(board_);
+  scratch_log_ = log_;
+  scratch_.Undo(placed_[k].mark);
+  bool consistent = Assign(scratch_, c, sym);
+  for (int p = k + 1; consistent && p < placed_.size(); p++)
+    consistent = Assign(scratch_, placed_[p].c, placed_[p].sym);
+  scratch_log_.clear();
+  return consistent;
+}
+
+void Session::Describe(hint *out) const {
+  unsigned int length = board_.length();
+  boost::unordered_map<unsigned int, size_t> at;
+  for (trail::const_iterator r = scratch_log_.begin();
+       r != scratch_log_.end(); ++r) {
+    if (at.find(r->x) == at.end()) {
+      at[r->x] = out->removals.size();
+      out->removals.push_back(*r);
+    }
+    else {
+      out->removals[at[r->x]].syms |= r->syms;
+    }
+  }
+  for (vector<removal>::const_iterator r = out->removals.begin();
+       r != out->removals.end(); ++r) {
+    cell c (r->x / length, r->x % length);
+    if (scratch_[c].single() && !board_[c].single())
+      out->placements.push_back(make_pair(c, scratch_[c].front()));
+  }
+}
+
+bool Session::NextStep(hint *out) {
+  if (!valid_)
+    return false;
+  *out = hint();
+  unsigned int length = board_.length();
+  for (unsigned int x = 0; x < length * length; x++) {
+    cell c (x / length, x % length);
+    if (!filled_[x] && board_[c].single()) {
+      out->name = "single";
+      out->placements.push_back(make_pair(c, board_[c].front()));
+      return true;
+    }
+  }
+  // Each strategy with the largest subset or fish it may look for.
+  vector<pair<strategy, unsigned int> > stages;
+  stages.push_back(make_pair(HIDDEN, 1u));
+  stages.push_back(make_pair(INTERSECTION, 0u));
+  for (unsigned int k = 2; k <= board_.blocksize(); k++) {
+    stages.push_back(make_pair(NAKED, k));
+    stages.push_back(make_pair(HIDDEN, k));
+  }
+  for (unsigned int k = 2; k <= MAX_HINT_FISH; k++)
+    stages.push_back(make_pair(FISH, k));
+  for (int s = COLORING; s <= AIC; s++)
+    stages.push_back(make_pair(static_cast<strategy>(s), 0u));
+
+  scratch_.CopyFrom(board_);
+  for (int k = 0; k < stages.size(); k++) {
+    Apply(stages[k].first, scratch_, stages[k].second, context());
+    if (scratch_log_.empty())
+      continue;
+    out->name = Scheduler::Name(stages[k].first);
+    out->size = stages[k].second;
+    Describe(out);
+    scratch_.Undo(0);
+    return true;
+  }
+  return false;
+}
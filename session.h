@@ -0,0 +1,94 @@
+#ifndef __SESSION_HEADER__
+#define __SESSION_HEADER__
+
+#include <utility>
+#include <vector>
+
+#include "sudoku.h"
+
+// The deductions of one step, as offered by Session::NextStep().
+struct hint {
+  // "single" for a cell with one candidate left, otherwise the name of
+  // the strategy that made the deduction, as Scheduler::Name() gives it.
+  const char *name;
+  // The largest subset or fish searched for when the deduction was made,
+  // 0 for singles and strategies without a size.
+  unsigned int size;
+  // Cells the deduction leaves with one candidate, and that candidate.
+  std::vector<std::pair<cell, int> > placements;
+  // The candidates it removes, one entry per cell.
+  std::vector<removal> removals;
+
+  hint() : name(NULL), size(0) { }
+};
+
+// A puzzle being filled in by a player, kept propagated with AC3 after
+// every change, for services answering on each keystroke. Placements are
+// propagated from the cell placed, on a trail, so clearing or replacing
+// one undoes the trail back to it and replays only the placements made
+// since, keeping their order.
+//
+// A session owns its boards; it cannot be copied.
+class Session {
+private:
+  struct placement {
+    cell c;
+    int sym;
+    // The length of the trail before the placement.
+    std::size_t mark;
+  };
+
+  Sudoku board_;
+  // A copy of the board for NextStep() to try strategies on.
+  Sudoku scratch_;
+  trail log_;
+  trail scratch_log_;
+  std::vector<placement> placed_;
+  // By Topology::index(): the cells given, and those given or placed.
+  std::vector<bool> given_;
+  std::vector<bool> filled_;
+  bool valid_;
+
+  Session(const Session &);
+  Session &operator=(const Session &);
+
+public:
+  // Starts from the givens of 'puzzle', which is not changed.
+  explicit Session(const Sudoku &puzzle);
+
+  // Whether the givens are consistent. Nothing can be placed if not.
+  bool valid() const { return valid_; }
+
+  // Places 'sym' in 'c', replacing any placement there. Returns false,
+  // leaving the board as it was, if 'c' is a given or propagating the
+  // placement empties a cell.
+  bool Place(const cell &c, int sym);
+  // Clears the placement in 'c'. Returns false if there is none.
+  bool Clear(const cell &c);
+  // Whether Place(c, sym) would succeed, without placing it.
+  bool Consistent(const cell &c, int sym);
+  // The candidates left for 'c' by the givens and placements.
+  symset Candidates(const cell &c) const { return board_[c]; }
+  const Sudoku &board() const { return board_; }
+
+  // Finds the simplest deductions from the board: the first cell solved
+  // by propagation but not placed, or else a pass of the first strategy
+  // to find any of hidden singles, intersections, naked and hidden
+  // subsets by size, fish, coloring and chains. Returns false if none
+  // does. The board is not changed.
+  bool NextStep(hint *out);
+
+private:
+  // The position of the placement in 'c' in placed_, or -1.
+  int Find(const cell &c) const;
+  // Places without checking the cell, returning false if propagation
+  // fails, with the trail undone.
+  bool Propagate(const cell &c, int sym);
+  // Undoes the trail back to 'mark' and propagates placements k onwards
+  // again, in order.
+  void Replay(std::size_t k, std::size_t mark);
+  // Describes what the strategy run on scratch_ removed.
+  void Describe(hint *out) const;
+};
+
+#endif // __SESSION_HEADER__
@@ -0,0 +1,406 @@
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "corpus.h"
+#include "shard.h"
+
+using namespace std;
+
+// Shards per worker when the caller leaves their size to us.
+static const size_t SHARDS_PER_WORKER = 8;
+// How often idle workers look for a shard, and the coordinator for
+// stragglers, dead workers and cancellation.
+static const chrono::milliseconds POLL (20);
+// A shard running this many times longer than finished shards took on
+// average is straggling, if it has run at least STRAGGLER_MILLIS.
+static const double STRAGGLER_FACTOR = 3;
+static const long STRAGGLER_MILLIS = 1000;
+// The shard of a worker without one, and of a worker that has exited.
+static const int NO_SHARD = -1;
+static const int GONE = -2;
+
+enum shardstate { FREE, RUNNING, DONE };
+// Whether a running shard may be claimed by a second worker.
+enum backupstate { NO_BACKUP, OFFERED, TAKEN };
+
+struct shardslot {
+  atomic<int> state;
+  atomic<int> backup;
+  // Copies of the shard running.
+  atomic<int> runners;
+  // Cancels the copies running, once one finishes or the run is cancelled.
+  atomic<bool> stop;
+  // When the shard was claimed, in milliseconds on the monotonic clock.
+  atomic<long> started;
+
+  shardslot()
+    : state(FREE), backup(NO_BACKUP), runners(0), stop(false), started(0)
+  { }
+};
+
+struct tableheader {
+  atomic<bool> cancelled;
+  // Shards finished, and the milliseconds they took between them.
+  atomic<size_t> done;
+  atomic<long> done_millis;
+
+  tableheader() : cancelled(false), done(0), done_millis(0) { }
+};
+
+// Lets the table live in memory shared between processes.
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LONG_LOCK_FREE == 2 &&
+              ATOMIC_CHAR_LOCK_FREE == 2 && ATOMIC_BOOL_LOCK_FREE == 2,
+              "atomics must be lock-free to be shared between processes");
+
+// The state shared by the coordinator and its workers: a header, a slot
+// per shard, the shard each worker is on and the outcome of each puzzle
+// by corpus position, in one mapping of POSIX shared memory.
+class sharedtable {
+private:
+  void *base_;
+  size_t bytes_;
+
+  sharedtable(const sharedtable &);
+  sharedtable &operator=(const sharedtable &);
+
+public:
+  tableheader *header;
+  shardslot *shards;
+  atomic<int> *workers;
+  atomic<unsigned char> *outcomes;
+
+  sharedtable()
+    : base_(NULL), bytes_(0), header(NULL), shards(NULL), workers(NULL),
+      outcomes(NULL) { }
+  ~sharedtable() {
+    if (base_)
+      munmap(base_, bytes_);
+  }
+
+  // Maps a table for the shards, workers and puzzles. Returns false,
+  // setting 'error', if the shared memory cannot be had.
+  bool Create(size_t shards, unsigned int workers, size_t puzzles,
+              string *error);
+};
+
+// Rounds 'bytes' up to a cache line, so the parts of the table do not
+// share one.
+static size_t Line(size_t bytes) {
+  return (bytes + 63) / 64 * 64;
+}
+
+// The reason the last system call failed, after what was being done.
+static string Failure(const char *doing) {
+  return string(doing) + ": " + strerror(errno);
+}
+
+bool sharedtable::Create(size_t shard_count, unsigned int worker_count,
+                         size_t puzzles, string *error) {
+  size_t at_shards = Line(sizeof(tableheader));
+  size_t at_workers = at_shards + Line(shard_count * sizeof(shardslot));
+  size_t at_outcomes = at_workers +
+    Line(worker_count * sizeof(atomic<int>));
+  bytes_ = at_outcomes + Line(puzzles * sizeof(atomic<unsigned char>));
+  char name[64];
+  snprintf(name, sizeof(name), "/sudoku-shards-%d", getpid());
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    *error = Failure("shm_open");
+    return false;
+  }
+  // The workers inherit the mapping, so the name can go at once and
+  // nothing is left behind if the run dies.
+  shm_unlink(name);
+  void *base = MAP_FAILED;
+  if (ftruncate(fd, bytes_) != 0)
+    *error = Failure("ftruncate");
+  else if ((base = mmap(NULL, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fd, 0)) == MAP_FAILED)
+    *error = Failure("mmap");
+  close(fd);
+  if (base == MAP_FAILED)
+    return false;
+  base_ = base;
+  char *at = static_cast<char *>(base_);
+  header = new (at) tableheader();
+  shards = reinterpret_cast<shardslot *>(at + at_shards);
+  for (size_t s = 0; s < shard_count; s++)
+    new (&shards[s]) shardslot();
+  workers = reinterpret_cast<atomic<int> *>(at + at_workers);
+  for (unsigned int w = 0; w < worker_count; w++)
+    new (&workers[w]) atomic<int>(NO_SHARD);
+  outcomes = reinterpret_cast<atomic<unsigned char> *>(at + at_outcomes);
+  for (size_t k = 0; k < puzzles; k++)
+    new (&outcomes[k]) atomic<unsigned char>(OUTCOME_NONE);
+  return true;
+}
+
+// Milliseconds on the monotonic clock, which every process shares.
+static long Millis() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000l + now.tv_nsec / 1000000;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- Pinning -----------------------------------
+// ---------------------------------------------------------------------------
+
+// Reads a Linux list such as "0-3,8,10-11" from 'path', empty if there is
+// none.
+static vector<int> ReadList(const string &path) {
+  vector<int> values;
+  ifstream in (path.c_str());
+  string list, range;
+  if (!getline(in, list))
+    return values;
+  istringstream ranges (list);
+  while (getline(ranges, range, ',')) {
+    int from, to;
+    int n = sscanf(range.c_str(), "%d-%d", &from, &to);
+    if (n < 1)
+      continue;
+    if (n == 1)
+      to = from;
+    for (int v = from; v <= to; v++)
+      values.push_back(v);
+  }
+  return values;
+}
+
+// Pins the calling process to the CPUs of NUMA node 'k' modulo the nodes
+// online, leaving it unpinned if Linux lists none.
+static void PinToNode(unsigned int k) {
+  const string nodes = "/sys/devices/system/node/";
+  vector<int> online = ReadList(nodes + "online");
+  if (online.empty())
+    return;
+  ostringstream path;
+  path << nodes << "node" << online[k % online.size()] << "/cpulist";
+  vector<int> cpus = ReadList(path.str());
+  if (cpus.empty())
+    return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int c = 0; c < cpus.size(); c++)
+    CPU_SET(cpus[c], &set);
+  sched_setaffinity(0, sizeof(set), &set);
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- Workers -----------------------------------
+// ---------------------------------------------------------------------------
+
+// Claims a free shard for worker 'w', or else a straggler offered for a
+// second run. Returns NO_SHARD if there is neither.
+static int Claim(sharedtable &t, size_t shards, unsigned int w) {
+  for (size_t s = 0; s < shards; s++) {
+    shardslot &slot = t.shards[s];
+    int free = FREE;
+    if (slot.state.load() == FREE &&
+        slot.state.compare_exchange_strong(free, RUNNING)) {
+      slot.runners++;
+      slot.started.store(Millis());
+      t.workers[w].store(s);
+      return s;
+    }
+  }
+  for (size_t s = 0; s < shards; s++) {
+    shardslot &slot = t.shards[s];
+    int offered = OFFERED;
+    if (slot.state.load() == RUNNING &&
+        slot.backup.compare_exchange_strong(offered, TAKEN)) {
+      slot.runners++;
+      t.workers[w].store(s);
+      return s;
+    }
+  }
+  return NO_SHARD;
+}
+
+// Solves shards of 'size' puzzles from 'first' until every one is done
+// or the run is cancelled.
+static void Work(const string &path, size_t first, size_t last, size_t size,
+                 unsigned int w, const shardoptions &opts, sharedtable &t) {
+  // Ctrl-C reaches the coordinator, which cancels through the table.
+  signal(SIGINT, SIG_IGN);
+  if (opts.pin)
+    PinToNode(w);
+  // The caller opened the corpus already, so this only fails if the file
+  // has changed since; the worker's shards then go to the others.
+  Corpus puzzles;
+  string error;
+  if (!puzzles.Open(path, &error))
+    return;
+  size_t shards = (last - first + size - 1) / size;
+  while (!t.header->cancelled.load()) {
+    int s = Claim(t, shards, w);
+    if (s == NO_SHARD) {
+      if (t.header->done.load() == shards)
+        break;
+      this_thread::sleep_for(POLL);
+      continue;
+    }
+    shardslot &slot = t.shards[s];
+    batchoptions batch = opts.batch;
+    batch.lim.cancel = &slot.stop;
+    batch.trace = NULL;
+    batch.outcomes = t.outcomes;
+    size_t from = first + s * size;
+    SolveBatch(puzzles, from, min(last, from + size), batch, -1);
+    // The first copy to finish uncancelled is the one that counts.
+    int running = RUNNING;
+    if (!slot.stop.load() &&
+        slot.state.compare_exchange_strong(running, DONE)) {
+      slot.stop.store(true);
+      t.header->done_millis += Millis() - slot.started.load();
+      t.header->done++;
+    }
+    t.workers[w].store(NO_SHARD);
+    slot.runners--;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// ----------------------------- Coordinator ---------------------------------
+// ---------------------------------------------------------------------------
+
+// Stops every worker after the puzzles in progress.
+static void Cancel(sharedtable &t, size_t shards) {
+  t.header->cancelled.store(true);
+  for (size_t s = 0; s < shards; s++)
+    t.shards[s].stop.store(true);
+}
+
+// Puts back the shard of worker 'w', which died, unless another copy of
+// it is running. Returns whether it was put back.
+static bool Release(sharedtable &t, unsigned int w) {
+  int s = t.workers[w].exchange(NO_SHARD);
+  if (s == NO_SHARD)
+    return false;
+  shardslot &slot = t.shards[s];
+  if (--slot.runners > 0 || slot.state.load() != RUNNING)
+    return false;
+  slot.backup.store(NO_BACKUP);
+  slot.stop.store(false);
+  slot.state.store(FREE);
+  return true;
+}
+
+// Once no shard is left to claim and some worker is idle, offers the
+// shards that are straggling to a second worker. Returns how many were
+// offered.
+static size_t OfferBackups(sharedtable &t, size_t shards,
+                           unsigned int workers) {
+  size_t done = t.header->done.load();
+  if (done == 0 || done == shards)
+    return 0;
+  bool idle = false;
+  for (unsigned int w = 0; w < workers; w++)
+    idle |= t.workers[w].load() == NO_SHARD;
+  if (!idle)
+    return 0;
+  for (size_t s = 0; s < shards; s++)
+    if (t.shards[s].state.load() == FREE)
+      return 0;
+  double mean = t.header->done_millis.load() / static_cast<double>(done);
+  long limit = max(STRAGGLER_MILLIS, static_cast<long>(STRAGGLER_FACTOR *
+                                                       mean));
+  long now = Millis();
+  size_t offered = 0;
+  for (size_t s = 0; s < shards; s++) {
+    shardslot &slot = t.shards[s];
+    int none = NO_BACKUP;
+    if (slot.state.load() == RUNNING &&
+        now - slot.started.load() > limit &&
+        slot.backup.compare_exchange_strong(none, OFFERED))
+      offered++;
+  }
+  return offered;
+}
+
+shardresult SolveSharded(const string &path, size_t first, size_t last,
+                         const shardoptions &opts) {
+  assert(opts.workers > 0 && first <= last);
+  size_t size = opts.shard_size;
+  if (size == 0) {
+    size_t pieces = opts.workers * SHARDS_PER_WORKER;
+    size = max<size_t>(1, (last - first + pieces - 1) / pieces);
+  }
+  size_t shards = (last - first + size - 1) / size;
+  shardresult result;
+  sharedtable t;
+  if (!t.Create(shards, opts.workers, last, &result.error))
+    return result;
+  long start = Millis();
+  vector<pid_t> pids;
+  for (unsigned int w = 0; w < opts.workers; w++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      // Those forked already are stopped and waited for below.
+      result.error = Failure("fork");
+      Cancel(t, shards);
+      break;
+    }
+    if (pid == 0) {
+      Work(path, first, last, size, w, opts, t);
+      // Skips the caller's exit handlers and buffered output.
+      _exit(0);
+    }
+    pids.push_back(pid);
+  }
+
+  const atomic<bool> *cancel = opts.batch.lim.cancel;
+  for (unsigned int alive = pids.size(); alive > 0; ) {
+    this_thread::sleep_for(POLL);
+    if (cancel && cancel->load() && !t.header->cancelled.load())
+      Cancel(t, shards);
+    for (unsigned int w = 0; w < pids.size(); w++) {
+      int status;
+      if (pids[w] <= 0 || waitpid(pids[w], &status, WNOHANG) != pids[w])
+        continue;
+      pids[w] = 0;
+      alive--;
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        result.reassigned += Release(t, w);
+      t.workers[w].store(GONE);
+    }
+    result.backups += OfferBackups(t, shards, opts.workers);
+  }
+  result.seconds = (Millis() - start) / 1e3;
+
+  result.puzzles = last - first;
+  for (size_t k = first; k < last; k++) {
+    switch (t.outcomes[k].load()) {
+    case OUTCOME_SOLVED:
+      result.solved++;
+      break;
+    case OUTCOME_FAILED:
+      result.failed++;
+      break;
+    case OUTCOME_TIMED_OUT:
+      result.timed_out++;
+      break;
+    default:
+      result.unfinished++;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,64 @@
+#ifndef __SHARD_HEADER__
+#define __SHARD_HEADER__
+
+#include <cstddef>
+#include <string>
+
+#include "pipeline.h"
+
+// How to split a corpus run over processes.
+struct shardoptions {
+  // Worker processes, forked from the caller.
+  unsigned int workers;
+  // Puzzles per shard; 0 gives each worker about SHARDS_PER_WORKER.
+  std::size_t shard_size;
+  // Pin worker k to the CPUs of NUMA node k, modulo the nodes Linux
+  // lists, so its memory is allocated on that node.
+  bool pin;
+  // How each worker solves a shard. Its cancel flag, read only by the
+  // coordinator, stops the whole run; 'trace' and 'outcomes' are unused.
+  batchoptions batch;
+
+  shardoptions() : workers(1), shard_size(0), pin(false) { }
+};
+
+struct shardresult {
+  std::size_t puzzles;
+  std::size_t solved;
+  std::size_t failed;
+  std::size_t timed_out;
+  // Puzzles never solved, as the run was cancelled or every worker died.
+  std::size_t unfinished;
+  // Wall time of the whole run.
+  double seconds;
+  // Shards offered to a second worker because the first was straggling,
+  // and shards put back because their worker died.
+  std::size_t backups;
+  std::size_t reassigned;
+  // Why the run could not start all its workers, empty if it did. Workers
+  // already forked are stopped and the counts are of what they did.
+  std::string error;
+
+  shardresult()
+    : puzzles(0), solved(0), failed(0), timed_out(0), unfinished(0),
+      seconds(0), backups(0), reassigned(0) { }
+};
+
+// Solves puzzles first to last - 1 of the corpus at 'path' on
+// opts.workers processes. The puzzles are split into shards, which
+// workers claim one at a time and solve with SolveBatch(), recording the
+// outcome of each puzzle in a table in POSIX shared memory. Boards are
+// not printed.
+//
+// The caller coordinates. Once no shard is left to claim, a shard that
+// has run several times longer than finished shards take on average is
+// offered to an idle worker as well. The first copy to finish cancels
+// the other. A shard whose worker dies is put back to be claimed again.
+// The result is merged from the table, or carries an error if the table
+// cannot be mapped or a worker cannot be forked.
+//
+// Must be called before the caller starts any threads, as it forks.
+shardresult SolveSharded(const std::string &path, std::size_t first,
+                         std::size_t last, const shardoptions &opts);
+
+#endif // __SHARD_HEADER__
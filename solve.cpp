@@ -0,0 +1,1062 @@
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <time.h>
+
+#include "solve.h"
+#include "sudoku.h"
+
+using namespace std;
+
+// Predicate for values missing from a small vector.
+class not_in {
+private:
+  const vector<unsigned int> &v_;
+public:
+  not_in(const vector<unsigned int> &v) : v_(v) { }
+  bool operator()(unsigned int x) const {
+    return find(v_.begin(), v_.end(), x) == v_.end();
+  }
+};
+
+// ---------------------------------------------------------------------------
+// -------------------------------- AC3 --------------------------------------
+// ---------------------------------------------------------------------------
+
+// Clears the symbol of each queued singleton from the cells of its units
+// that can still hold it, found from the board's places, and queues the
+// cells left single in turn. 'queued' marks the cells ever queued, so
+// each is cleared from once. Returns false if some cell has no symbols
+// left.
+static bool Push(Sudoku &board, vector<unsigned int> &queue,
+                 vector<bool> &queued, Budget *budget) {
+  const Topology &topo = board.topology();
+  unsigned int length = board.length();
+  for (size_t next = 0; next < queue.size(); next++) {
+    if (budget && !budget->Step())
+      return true;
+    cell c (queue[next] / length, queue[next] % length);
+    const symset &dom = board[c];
+    int sym = dom.front();
+    const vector<unsigned int> &units = topo.units(c);
+    for (vector<unsigned int>::const_iterator u = units.begin();
+         u != units.end(); ++u) {
+      const vector<cell> &unit = topo.unit(*u);
+      // Copied, as clearing the symbol changes the places.
+      symset where = board.places(*u, sym);
+      for (symset::const_iterator p = where.begin(); p != where.end();
+           ++p) {
+        const cell &peer = unit[*p];
+        if (peer == c)
+          continue;
+        board.Subtract(peer, dom);
+        const symset &left = board[peer];
+        if (left.empty())
+          return false;
+        unsigned int x = topo.index(peer);
+        if (left.single() && !queued[x]) {
+          queued[x] = true;
+          queue.push_back(x);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool AC3(Sudoku &board, Budget *budget) {
+  unsigned int length = board.length();
+  vector<unsigned int> queue;
+  vector<bool> queued (length * length);
+  for (unsigned int x = 0; x < length * length; x++) {
+    const symset &dom = board[x / length][x % length];
+    if (dom.empty())
+      return false;
+    if (dom.single()) {
+      queued[x] = true;
+      queue.push_back(x);
+    }
+  }
+  return Push(board, queue, queued, budget);
+}
+
+bool AC3(Sudoku &board, const cell &changed, Budget *budget) {
+  const symset &dom = board[changed];
+  if (dom.empty())
+    return false;
+  if (!dom.single())
+    return true;
+  unsigned int length = board.length();
+  vector<unsigned int> queue (1, board.topology().index(changed));
+  vector<bool> queued (length * length);
+  queued[queue[0]] = true;
+  return Push(board, queue, queued, budget);
+}
+
+// ---------------------------------------------------------------------------
+// -------------------------------- Fish -------------------------------------
+// ---------------------------------------------------------------------------
+
+// The lines of one direction, and for each the cells it crosses in the
+// other direction. Fish are found on the places of a symbol in 'bases'
+// and eliminate it along 'covers'.
+struct fishlines {
+  vector<unsigned int> bases;
+  // covers[p] is the unit crossing every base at position p.
+  vector<unsigned int> covers;
+};
+
+// Extends a fish on 'sym' from bases[first..] while the union of base
+// places has at most 'size' positions. Returns the number of symbols
+// removed.
+unsigned int GrowFish(Sudoku &board, const fishlines &lines,
+                      const vector<unsigned int> &candidates,
+                      unsigned int first, vector<unsigned int> &fish,
+                      const symset &places, int sym, unsigned int size) {
+  if (fish.size() == size) {
+    if (places.size() != size)
+      return 0;
+    // Only the crossings with the fish's bases may keep the symbol.
+    symset syms;
+    syms.insert(sym);
+    unsigned int removed = 0;
+    const Topology &topo = board.topology();
+    for (symset::const_iterator p = places.begin(); p != places.end(); ++p) {
+      unsigned int cover = lines.covers[*p];
+      const vector<cell> &unit = topo.unit(cover);
+      for (vector<cell>::const_iterator c = unit.begin(); c != unit.end();
+           ++c) {
+        const vector<unsigned int> &units = topo.units(*c);
+        bool crossing = false;
+        for (int f = 0; f < fish.size() && !crossing; f++)
+          crossing = find(units.begin(), units.end(), fish[f]) != units.end();
+        if (!crossing)
+          removed += board.Subtract(*c, syms);
+      }
+    }
+    return removed;
+  }
+  unsigned int removed = 0;
+  for (unsigned int b = first; b < candidates.size(); b++) {
+    symset grown = places;
+    grown |= board.places(candidates[b], sym);
+    if (grown.size() > size)
+      continue;
+    fish.push_back(candidates[b]);
+    removed += GrowFish(board, lines, candidates, b + 1, fish, grown, sym,
+                        size);
+    fish.pop_back();
+  }
+  return removed;
+}
+
+// Looks for fish of 2 to 'max_size' lines: base lines where a symbol is
+// confined to as many cross lines, which then lose it everywhere else.
+// An X-wing has size 2 and a swordfish size 3. Pure mask comparisons on
+// the places of each symbol.
+bool Fish(Sudoku &board, unsigned int max_size,
+          vector<unsigned long> *by_size) {
+  const Topology &topo = board.topology();
+  unsigned int length = board.length();
+  fishlines lines[2];
+  for (unsigned int u = 0; u < topo.size(); u++) {
+    if (topo.kind(u) == ROW)
+      lines[0].bases.push_back(u);
+    else if (topo.kind(u) == COL)
+      lines[1].bases.push_back(u);
+  }
+  // Rows list their cells by column and columns theirs by row, so each
+  // direction is covered by the lines of the other.
+  lines[0].covers = lines[1].bases;
+  lines[1].covers = lines[0].bases;
+  bool change = false;
+  for (int d = 0; d < 2; d++) {
+    for (unsigned int size = 2; size <= max_size; size++) {
+      for (int sym = 0; sym < length; sym++) {
+        vector<unsigned int> candidates;
+        for (int b = 0; b < lines[d].bases.size(); b++) {
+          size_t n = board.places(lines[d].bases[b], sym).size();
+          if (n >= 2 && n <= size)
+            candidates.push_back(lines[d].bases[b]);
+        }
+        if (candidates.size() < size)
+          continue;
+        vector<unsigned int> fish;
+        unsigned int removed = GrowFish(board, lines[d], candidates, 0, fish,
+                                        symset(), sym, size);
+        if (removed > 0) {
+          change = true;
+          if (by_size)
+            (*by_size)[size] += removed;
+        }
+      }
+    }
+  }
+  return change;
+}
+
+// ---------------------------------------------------------------------------
+// ---------------------------- Intersections --------------------------------
+// ---------------------------------------------------------------------------
+
+// Removes 'syms' from the cells of unit 'u' outside the positions
+// 'shared'. Returns the number of symbols removed.
+static unsigned int RemoveOutside(Sudoku &board, unsigned int u,
+                                  const symset &shared, const symset &syms) {
+  unsigned int removed = 0;
+  const vector<cell> &unit = board.topology().unit(u);
+  for (int p = 0; p < unit.size(); p++)
+    if (!shared.count(p))
+      removed += board.Subtract(unit[p], syms);
+  return removed;
+}
+
+// Pointing pairs and box-line reduction, generalised to any two units
+// sharing cells: symbols that one unit can only hold in the shared cells
+// are removed from the rest of the other. Each intersection is handled
+// for all symbols at once, from the unions of the domains inside and
+// outside the shared cells.
+bool Intersections(Sudoku &board, vector<unsigned long> *by_size) {
+  const Topology &topo = board.topology();
+  const vector<intersection> &crossings = topo.intersections();
+  bool change = false;
+  for (vector<intersection>::const_iterator it = crossings.begin();
+       it != crossings.end(); ++it) {
+    symset inside, outside[2];
+    for (int side = 0; side < 2; side++) {
+      const vector<cell> &unit = topo.unit(it->units[side]);
+      for (int p = 0; p < unit.size(); p++) {
+        if (!it->shared[side].count(p))
+          outside[side] |= board[unit[p]];
+        else if (side == 0)
+          inside |= board[unit[p]];
+      }
+    }
+    unsigned int removed = 0;
+    for (int side = 0; side < 2; side++) {
+      symset confined = inside;
+      confined.subtract(outside[side]);
+      if (!confined.empty())
+        removed += RemoveOutside(board, it->units[1 - side],
+                                 it->shared[1 - side], confined);
+    }
+    if (removed > 0) {
+      change = true;
+      if (by_size)
+        (*by_size)[0] += removed;
+    }
+  }
+  return change;
+}
+
+// ---------------------------------------------------------------------------
+// --------------------------- Symbol Removal --------------------------------
+// ---------------------------------------------------------------------------
+
+// Passed to RemoveSymsFromOtherCells when no unit is already done.
+static const unsigned int NONE = ~0u;
+
+// Finds the units that contain every cell in 'cells'.
+void SameGroup(const Sudoku &board, const vector<cell> &cells,
+               vector<unsigned int> &units) {
+  units.clear();
+  if (cells.size() == 0)
+    return;
+  const Topology &topo = board.topology();
+  vector<cell>::const_iterator it = cells.begin();
+  units = topo.units(*it);
+  for (++it; it != cells.end() && !units.empty(); ++it) {
+    const vector<unsigned int> &units2 = topo.units(*it);
+    vector<unsigned int>::iterator last =
+      remove_if(units.begin(), units.end(), not_in(units2));
+    units.erase(last, units.end());
+  }
+}
+
+// Removes the symbols 'syms' from all other cells in the same
+// group as 'cells', returning how many were removed.
+// If the symbols have already been removed from a unit, pass its index
+// as 'done'. Otherwise, pass NONE.
+unsigned int RemoveSymsFromOtherCells(Sudoku &board, const vector<cell> &cells,
+                                      const symset &syms, unsigned int done) {
+  unsigned int removed = 0;
+  vector<unsigned int> units;
+  SameGroup(board, cells, units);
+  for (vector<unsigned int>::const_iterator u = units.begin();
+       u != units.end(); ++u) {
+    if (*u == done)
+      continue;
+    const vector<cell> &unit = board.topology().unit(*u);
+    for (vector<cell>::const_iterator it = unit.begin();
+         it != unit.end(); ++it)
+      if (find(cells.begin(), cells.end(), *it) == cells.end())
+        removed += board.Subtract(*it, syms);
+  }
+  return removed;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------- Naked Permutations ------------------------------
+// ---------------------------------------------------------------------------
+
+// Checks to see whether cell 'c' with domain 'dom' is a superset of a
+// naked permutation in unit 'u'. Returns the number of symbols removed.
+unsigned int SearchGroupForNaked(Sudoku &board, cellset &done,
+                                 const symset &dom, const cell &c,
+                                 unsigned int u) {
+  if (done.find(c) == done.end()) {
+    vector<cell> found;
+    found.push_back(c);
+    const vector<cell> &unit = board.topology().unit(u);
+    for (vector<cell>::const_iterator it = unit.begin();
+         it != unit.end(); ++it) {
+      const cell &c2 = *it;
+      if (board[c2].single())
+        continue;
+      if (c2 != c && done.find(c2) == done.end() &&
+          board[c2].subsetof(dom)) {
+        found.push_back(c2);
+      }
+    }
+    if (found.size() == dom.size()) {
+      done.insert(found.begin(), found.end());
+      return RemoveSymsFromOtherCells(board, found, dom, NONE);
+    }
+  }
+  return 0;
+}
+
+/**
+ * for each cell c of size k:
+ *   find other cells c' with D(c) = D(c')
+ *   if k cells total, naked exact perm
+ *
+ * Misses perms like (2,3),(3,4),(2,4)
+ * Catches (2,4),(2,4) or (2,3,4),(2,3,4),(2,3,4) or (2,3,4),(2,3),(3,4)
+ */
+bool FindMostNakedPerms(Sudoku &board, unsigned int max_perm_size,
+                        vector<unsigned long> *by_size) {
+  bool change = false;
+  // This keeps track of whether a cell needs to be searched for perms
+  // in each of its units.
+  vector<cellset> done (board.topology().size());
+  const vector<cell> &cells = board.OrderedCells();
+  for (vector<cell>::const_iterator it = cells.begin();
+       it != cells.end(); ++it) {
+    cell c = *it;
+    const symset &dom = board[c];
+    int k = dom.size();
+    if (k == 1 || k > max_perm_size)
+      continue;
+
+    const vector<unsigned int> &units = board.topology().units(c);
+    for (vector<unsigned int>::const_iterator u = units.begin();
+         u != units.end(); ++u) {
+      unsigned int removed = SearchGroupForNaked(board, done[*u], dom, c, *u);
+      if (removed > 0) {
+        change = true;
+        if (by_size)
+          (*by_size)[k] += removed;
+      }
+    }
+  }
+  return change;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------- Hidden Permutations -----------------------------
+// ---------------------------------------------------------------------------
+
+// Delete all but the symbols in 'syms' from the cells in 'perm',
+// returning how many were deleted.
+unsigned int ProcessHiddenPerm(Sudoku &board, const vector<cell> &perm,
+                               const symset &syms) {
+  unsigned int removed = 0;
+  for (vector<cell>::const_iterator it = perm.begin(); it != perm.end(); ++it)
+    removed += board.Restrict(*it, syms);
+  return removed;
+}
+
+/** 
+ * for each sym s:
+ *   find c_1,...,c_k s.t. s in D(c)
+ *   if union of c_i minus the rest of the group has size k:
+ *     we have a hidden perm
+ *
+ * This will catch the case where a symbol can only go in one cell.
+ * Intersections are left to Intersections().
+ *
+ * The cells come from the board's places of s in the unit.
+ */
+bool SearchGroupForHidden(Sudoku &board, unsigned int max_perm_size,
+                          vector<unsigned long> *by_size) {
+  bool change = false;
+  const Topology &topo = board.topology();
+  vector<cell> cells;
+  for (unsigned int u = 0; u < topo.size(); u++) {
+    const vector<cell> &unit = topo.unit(u);
+    symset open;
+    for (int p = 0; p < unit.size(); p++)
+      if (!board[unit[p]].single())
+        open.insert(p);
+    for (int sym = 0; sym < board.length(); sym++) {
+      // A symbol already placed in the unit has no open places to find.
+      const symset &where = board.places(u, sym);
+      if (where.empty() || !where.subsetof(open))
+        continue;
+      int k = where.size();
+      cells.clear();
+      for (symset::const_iterator p = where.begin(); p != where.end(); ++p)
+        cells.push_back(unit[*p]);
+      if (k > max_perm_size)
+        continue;
+      // (union of cells) \ (union of not cells)
+      // if that size is k, we're in business
+      symset others, these;
+      for (int p = 0; p < unit.size(); p++) {
+        if (where.count(p))
+          these |= board[unit[p]];
+        else
+          others |= board[unit[p]];
+      }
+      these.subtract(others);
+      if (these.size() == k) {
+        // delete everything from cells not in these
+        // check whether naked perm in other group
+        unsigned int removed = ProcessHiddenPerm(board, cells, these);
+        if (removed > 0) {
+          change = true;
+          if (by_size)
+            (*by_size)[k] += removed;
+        }
+      }
+    }
+  }
+  return change;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------- Probing -----------------------------------
+// ---------------------------------------------------------------------------
+
+// What probing the candidates of one cell found.
+struct probe {
+  cell c;
+  // Candidates whose assignment propagated to a contradiction.
+  symset failed;
+  // Each cell's domain after propagation, united over the candidates that
+  // did not fail.
+  vector<symset> implied;
+  // Propagation steps taken.
+  unsigned long steps;
+  // Whether every candidate was tried before the budget ran out.
+  bool done;
+
+  explicit probe(const cell &c) : c(c), steps(0), done(false) { }
+};
+
+// Probes every 'stride'th cell from 'first' on a copy of the board,
+// undoing each probe from a trail. Counts against a copy of 'budget', so
+// each thread stops at its deadline or cancellation, or once it alone has
+// taken the steps left.
+static void ProbeCells(const Sudoku &board, vector<probe> &probes,
+                       unsigned int first, unsigned int stride,
+                       Budget budget) {
+  unsigned int length = board.length();
+  Sudoku work = board.Clone();
+  trail log;
+  work.Track(&log);
+  for (unsigned int k = first; k < probes.size(); k += stride) {
+    probe &p = probes[k];
+    p.implied.assign(length * length, symset());
+    const symset &dom = board[p.c];
+    for (symset::const_iterator it = dom.begin(); it != dom.end(); ++it) {
+      symset only;
+      only.insert(*it);
+      work.Restrict(p.c, only);
+      unsigned long before = budget.steps();
+      if (!AC3(work, p.c, &budget))
+        p.failed.insert(*it);
+      else
+        for (unsigned int x = 0; x < length * length; x++)
+          p.implied[x] |= work[x / length][x % length];
+      p.steps += budget.steps() - before;
+      work.Undo(0);
+    }
+    // A candidate cut short implies less than it should, which is sound,
+    // but those not tried imply nothing.
+    if (budget.exhausted())
+      return;
+    p.done = true;
+  }
+}
+
+// Helper threads kept for the probe rounds of a search, each waiting for
+// the next round and probing its share of the cells.
+class ProbePool {
+private:
+  mutex lock_;
+  condition_variable wake_;
+  condition_variable done_;
+  vector<thread> helpers_;
+  // The round being probed, its number, and the helpers yet to finish it.
+  const Sudoku *board_;
+  vector<probe> *probes_;
+  unsigned int stride_;
+  const Budget *budget_;
+  unsigned long round_;
+  unsigned int running_;
+  bool stop_;
+
+  ProbePool(const ProbePool &);
+  ProbePool &operator=(const ProbePool &);
+
+public:
+  explicit ProbePool(unsigned int helpers);
+  ~ProbePool();
+
+  unsigned int size() const { return helpers_.size(); }
+  // Probes cells 'stride' apart on the calling thread and stride - 1
+  // helpers, returning once all are done.
+  void Run(const Sudoku &board, vector<probe> &probes, unsigned int stride,
+           const Budget &budget);
+
+private:
+  void Help(unsigned int first);
+};
+
+ProbePool::ProbePool(unsigned int helpers)
+  : board_(NULL), probes_(NULL), stride_(1), budget_(NULL), round_(0),
+    running_(0), stop_(false) {
+  for (unsigned int t = 1; t <= helpers; t++)
+    helpers_.push_back(thread(&ProbePool::Help, this, t));
+}
+
+ProbePool::~ProbePool() {
+  {
+    lock_guard<mutex> hold (lock_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (int t = 0; t < helpers_.size(); t++)
+    helpers_[t].join();
+}
+
+void ProbePool::Run(const Sudoku &board, vector<probe> &probes,
+                    unsigned int stride, const Budget &budget) {
+  assert(stride <= size() + 1);
+  {
+    lock_guard<mutex> hold (lock_);
+    board_ = &board;
+    probes_ = &probes;
+    stride_ = stride;
+    budget_ = &budget;
+    running_ = size();
+    round_++;
+  }
+  wake_.notify_all();
+  ProbeCells(board, probes, 0, stride, budget);
+  unique_lock<mutex> hold (lock_);
+  while (running_ > 0)
+    done_.wait(hold);
+}
+
+void ProbePool::Help(unsigned int first) {
+  unsigned long seen = 0;
+  unique_lock<mutex> hold (lock_);
+  for (;;) {
+    while (!stop_ && round_ == seen)
+      wake_.wait(hold);
+    if (stop_)
+      return;
+    seen = round_;
+    // Helpers past the stride sit the round out.
+    if (first < stride_) {
+      const Sudoku &board = *board_;
+      vector<probe> &probes = *probes_;
+      unsigned int stride = stride_;
+      Budget budget = *budget_;
+      hold.unlock();
+      ProbeCells(board, probes, first, stride, budget);
+      hold.lock();
+    }
+    if (--running_ == 0)
+      done_.notify_one();
+  }
+}
+
+bool Probe(Sudoku &board, const context &ctx, bool *error) {
+  limits unlimited;
+  Budget own (unlimited);
+  Budget *budget = ctx.budget ? ctx.budget : &own;
+  if (budget->exhausted())
+    return false;
+  unsigned int length = board.length();
+  vector<cell> cells = board.OrderedCells();
+  vector<probe> probes;
+  for (int k = 0; k < cells.size() && k < ctx.probe; k++)
+    probes.push_back(probe(cells[k]));
+  if (probes.empty())
+    return false;
+  ProbePool *pool = ctx.probe_pool;
+  unsigned int threads = pool ? min<unsigned int>(pool->size() + 1,
+                                                  probes.size()) : 1;
+  if (threads > 1)
+    pool->Run(board, probes, threads, *budget);
+  else
+    ProbeCells(board, probes, 0, 1, *budget);
+  for (vector<probe>::const_iterator p = probes.begin();
+       p != probes.end(); ++p)
+    budget->Step(p->steps);
+  bool change = false;
+  for (vector<probe>::const_iterator p = probes.begin();
+       p != probes.end(); ++p) {
+    if (!p->done)
+      continue;
+    if (board[p->c].subsetof(p->failed)) {
+      *error = true;
+      return true;
+    }
+    // The solution takes one of the candidates left, so it lies within
+    // what they imply together.
+    for (unsigned int x = 0; x < length * length; x++)
+      change |= board.Restrict(cell(x / length, x % length),
+                               p->implied[x]) > 0;
+  }
+  return change;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------ Solvers ------------------------------------
+// ---------------------------------------------------------------------------
+
+// The largest fish worth looking for.
+static const unsigned int MAX_FISH = 3;
+
+bool Run(strategy s, Sudoku &board, unsigned int max_perm_size,
+         vector<unsigned long> *by_size, bool *error) {
+  switch (s) {
+  case INTERSECTION:
+    return Intersections(board, by_size);
+  case HIDDEN:
+    return SearchGroupForHidden(board, max_perm_size, by_size);
+  case NAKED:
+    return FindMostNakedPerms(board, max_perm_size, by_size);
+  case FISH:
+    return Fish(board, max_perm_size, by_size);
+  case COLORING:
+    return Coloring(board, by_size);
+  case X_CHAIN:
+  case XY_CHAIN:
+  case AIC:
+    return Chains(board, s, by_size);
+  case TEMPLATE:
+    return Templates(board, error, by_size);
+  case NUM_STRATEGIES:
+    break;
+  }
+  return false;
+}
+
+bool Apply(strategy s, Sudoku &board, unsigned int max_perm_size,
+           const context &ctx, unsigned long *eliminations, bool *error) {
+  bool unused = false;
+  if (error == NULL)
+    error = &unused;
+  if (s == FISH)
+    max_perm_size = min(max_perm_size, MAX_FISH);
+  tracespan span (ctx.trace, Scheduler::Name(s));
+  if (ctx.scheduler == NULL)
+    return Run(s, board, max_perm_size, NULL, error);
+  vector<unsigned long> by_size (max_perm_size + 1);
+  double start = Scheduler::Now();
+  bool change = Run(s, board, max_perm_size, &by_size, error);
+  ctx.scheduler->Record(s, board.length(), Scheduler::Now() - start, by_size);
+  if (eliminations)
+    for (int k = 0; k < by_size.size(); k++)
+      *eliminations += by_size[k];
+  return change;
+}
+
+// AC3 over the whole board, as a span of the trace.
+static bool Propagate(Sudoku &board, const context &ctx) {
+  tracespan span (ctx.trace, "ac3");
+  return AC3(board, ctx.budget);
+}
+
+// Sets the trace's counter of the candidates left on the board.
+static void CountCandidates(const Sudoku &board, const context &ctx) {
+  if (!ctx.trace)
+    return;
+  long candidates = 0;
+  for (int i = 0; i < board.length(); i++)
+    for (int j = 0; j < board.length(); j++)
+      candidates += board[i][j].size();
+  ctx.trace->Count("candidates", candidates);
+}
+
+// Runs the strategies the scheduler picks, best first, going back to the
+// best after any of them makes progress.
+bool AdaptiveLogicSolve(Sudoku &board, const context &ctx) {
+  Budget *budget = ctx.budget;
+  Scheduler *sched = ctx.scheduler;
+  bool success = Propagate(board, ctx);
+  bool change = true;
+  while (change && success) {
+    tracespan round (ctx.trace, "round");
+    change = false;
+    double start = Scheduler::Now();
+    unsigned long eliminations = 0;
+    const vector<strategy> &order = sched->Order(board.length());
+    for (vector<strategy>::const_iterator s = order.begin();
+         s != order.end() && !change; ++s) {
+      if (*s == TEMPLATE && !ctx.templates)
+        continue;
+      if (budget && !budget->Step())
+        return true;
+      unsigned int max_perm_size =
+        sched->MaxSize(*s, board.length(), board.blocksize());
+      bool error = false;
+      if (Apply(*s, board, max_perm_size, ctx, &eliminations, &error)) {
+        success = !error && Propagate(board, ctx);
+        change = true;
+      }
+    }
+    CountCandidates(board, ctx);
+    if (ctx.depth > 0 && change &&
+        sched->Abandon(board.length(), eliminations,
+                       Scheduler::Now() - start))
+      break;
+  }
+  return success;
+}
+
+// TODO nested while loops, common strategies in the inner one
+bool LogicSolve(Sudoku &board, const context &ctx) {
+  if (ctx.scheduler && ctx.scheduler->adaptive())
+    return AdaptiveLogicSolve(board, ctx);
+  Budget *budget = ctx.budget;
+  bool change = true;
+  bool success = Propagate(board, ctx);
+  unsigned int max_perm_size = board.blocksize();
+  while (change) {
+    if (!success)
+      return false;
+    tracespan round (ctx.trace, "round");
+    if (budget && !budget->Step())
+      return true;
+    // Intersections only remove candidates, which the hidden search is
+    // sound without propagating, so the two share a pass of AC3.
+    bool res0 = Apply(INTERSECTION, board, max_perm_size, ctx);
+    bool res1 = Apply(HIDDEN, board, max_perm_size, ctx);
+    if (res0 || res1)
+      success &= Propagate(board, ctx);
+    if (budget && !budget->Step())
+      return success;
+    bool res2 = Apply(NAKED, board, max_perm_size, ctx);
+    if (res2)
+      success &= Propagate(board, ctx);
+    if (budget && !budget->Step())
+      return success;
+    bool res3 = Apply(FISH, board, max_perm_size, ctx);
+    if (res3)
+      success &= Propagate(board, ctx);
+    // Templates find every fish, so they follow to catch what is left.
+    bool res4 = false;
+    if (ctx.templates) {
+      if (budget && !budget->Step())
+        return success;
+      bool error = false;
+      res4 = Apply(TEMPLATE, board, max_perm_size, ctx, NULL, &error);
+      if (error)
+        return false;
+      if (res4)
+        success &= Propagate(board, ctx);
+    }
+    change = res0 || res1 || res2 || res3 || res4;
+    // Chains cost more than the rest together, so they only run once the
+    // others are stuck, cheapest first.
+    for (int s = COLORING; s <= AIC && !change; s++) {
+      if (budget && !budget->Step())
+        return success;
+      change = Apply(static_cast<strategy>(s), board, max_perm_size, ctx);
+      if (change)
+        success &= Propagate(board, ctx);
+    }
+    CountCandidates(board, ctx);
+  }
+  return true;
+}
+
+// Picks an unsolved cell to guess, at random among those tied if the
+// search is randomized.
+static cell Branch(const Sudoku &board, const context &ctx) {
+  const vector<cell> &cells = board.OrderedCells();
+  size_t fewest = board[cells.front()].size();
+  vector<cell> ties;
+  int busiest = -1;
+  for (vector<cell>::const_iterator it = cells.begin();
+       it != cells.end() && board[*it].size() == fewest; ++it) {
+    if (ctx.branch == FEWEST) {
+      ties.push_back(*it);
+      if (!ctx.random)
+        break;
+      continue;
+    }
+    const vector<cell> &peers = board.conflicting(*it);
+    int unsolved = 0;
+    for (vector<cell>::const_iterator p = peers.begin(); p != peers.end();
+         ++p)
+      unsolved += !board[*p].single();
+    if (unsolved > busiest) {
+      busiest = unsolved;
+      ties.clear();
+    }
+    if (unsolved == busiest)
+      ties.push_back(*it);
+  }
+  if (!ctx.random)
+    return ties.front();
+  return ties[(*ctx.random)() % ties.size()];
+}
+
+solvestatus GuessSolve(Sudoku &board, const context &ctx) {
+  Search search (board, ctx);
+  search.Run(numeric_limits<unsigned long>::max());
+  return search.status();
+}
+
+Search::Search(Sudoku &board, const context &ctx)
+  : board_(board), ctx_(ctx), pool_(NULL), started_(false),
+    finished_(false), status_(TIMED_OUT), nodes_(0) {
+  if (ctx.probe > 0 && ctx.probe_threads > 1 && !ctx.probe_pool)
+    ctx_.probe_pool = pool_ = new ProbePool(ctx.probe_threads - 1);
+}
+
+Search::~Search() {
+  delete pool_;
+}
+
+bool Search::Run(unsigned long nodes) {
+  for (unsigned long n = 0; n < nodes && !finished_; ) {
+    bool searched = Step();
+    n += searched;
+    nodes_ += searched;
+  }
+  return finished_;
+}
+
+bool Search::Step() {
+  solvestatus status;
+  if (!started_) {
+    started_ = true;
+    if (Expand(board_, ctx_.depth, &status))
+      Finish(status);
+    return status != TIMED_OUT;
+  }
+  frame &top = stack_.back();
+  if (top.next == top.order.size()) {
+    stack_.pop_back();
+    if (stack_.empty())
+      Finish(UNSOLVABLE);
+    else if (ctx_.trace)
+      ctx_.trace->End("guess");
+    return false;
+  }
+  int sym = top.order[top.next++];
+  Sudoku board = top.board.Clone();
+  symset dom;
+  dom.insert(sym);
+  board.Set(top.guess, dom);
+  if (ctx_.trace)
+    ctx_.trace->Guess(top.guess, board.alphabet()[sym]);
+  if (!Expand(board, ctx_.depth + stack_.size(), &status))
+    return true;
+  if (status == TIMED_OUT)
+    top.next--;
+  if (ctx_.trace)
+    ctx_.trace->End("guess");
+  if (status == SOLVED)
+    board_.CopyFrom(board);
+  if (status != UNSOLVABLE)
+    Finish(status);
+  // A node cut off is searched again on resuming.
+  return status != TIMED_OUT;
+}
+
+bool Search::Expand(Sudoku &board, unsigned int depth, solvestatus *status) {
+  context ctx = ctx_;
+  ctx.depth = depth;
+  Budget *budget = ctx.budget;
+  *status = TIMED_OUT;
+  if (budget && !budget->Node())
+    return true;
+  bool success = LogicSolve(board, ctx);
+  if (budget && budget->exhausted())
+    return true;
+  *status = UNSOLVABLE;
+  if (!success)
+    return true;
+  *status = SOLVED;
+  if (board.Solved())
+    return true;
+  bool error = false;
+  bool probed = false;
+  if (ctx.probe > 0) {
+    tracespan span (ctx.trace, "probe");
+    probed = Probe(board, ctx, &error);
+  }
+  if (probed) {
+    *status = UNSOLVABLE;
+    if (error || !LogicSolve(board, ctx))
+      return true;
+    *status = TIMED_OUT;
+    if (budget && budget->exhausted())
+      return true;
+    *status = SOLVED;
+    if (board.Solved())
+      return true;
+  }
+  frame f (board);
+  f.guess = Branch(board, ctx);
+  const symset dom = board[f.guess];
+  f.order.assign(dom.begin(), dom.end());
+  if (ctx.random)
+    for (int k = f.order.size() - 1; k > 0; k--)
+      swap(f.order[k], f.order[(*ctx.random)() % (k + 1)]);
+  stack_.push_back(f);
+  return false;
+}
+
+void Search::Finish(solvestatus status) {
+  // Closes the spans of the guesses still open, as unwinding GuessSolve
+  // would.
+  for (size_t k = 1; ctx_.trace && k < stack_.size(); k++)
+    ctx_.trace->End("guess");
+  if (status != TIMED_OUT)
+    stack_.clear();
+  finished_ = true;
+  status_ = status;
+}
+
+// The i-th term, from 1, of the Luby sequence 1, 1, 2, 1, 1, 2, 4, ...
+static unsigned long Luby(unsigned long i) {
+  for (;;) {
+    unsigned int k = 1;
+    while ((1ul << k) - 1 < i)
+      k++;
+    if (i == (1ul << k) - 1)
+      return 1ul << (k - 1);
+    i -= (1ul << (k - 1)) - 1;
+  }
+}
+
+// The most nodes a run is given, so geometric growth cannot overflow.
+static const double MAX_RUN = 1e15;
+
+solvestatus RandomizedSolve(Sudoku &board, const context &ctx) {
+  const randomsearch &search = *ctx.randomized;
+  mt19937_64 random (search.seed);
+  context run = ctx;
+  run.random = &random;
+  if (search.restarts == NO_RESTARTS)
+    return GuessSolve(board, run);
+  // One pool of probe helpers for all the runs.
+  ProbePool *pool = NULL;
+  if (run.probe > 0 && run.probe_threads > 1 && !run.probe_pool)
+    run.probe_pool = pool = new ProbePool(run.probe_threads - 1);
+  limits unlimited;
+  Budget own (unlimited);
+  if (run.budget == NULL)
+    run.budget = &own;
+  Sudoku given = board.Clone();
+  double nodes = search.nodes;
+  for (unsigned long n = 1; ; n++) {
+    if (search.restarts == LUBY)
+      nodes = search.nodes * static_cast<double>(Luby(n));
+    else if (n > 1)
+      nodes = min(nodes * search.factor, MAX_RUN);
+    if (n > 1)
+      board.CopyFrom(given);
+    run.budget->Cutoff(max(1ul, static_cast<unsigned long>(nodes)));
+    solvestatus status = GuessSolve(board, run);
+    bool cut = run.budget->cut_off();
+    run.budget->Cutoff(0);
+    if (status != TIMED_OUT || !cut) {
+      delete pool;
+      return status;
+    }
+  }
+}
+
+solvestatus Solve(Sudoku &board, bool logic_only, const context &ctx) {
+  if (!logic_only && ctx.randomized)
+    return RandomizedSolve(board, ctx);
+  if (!logic_only)
+    return GuessSolve(board, ctx);
+  bool success = LogicSolve(board, ctx);
+  if (ctx.budget && ctx.budget->exhausted())
+    return TIMED_OUT;
+  return success ? SOLVED : UNSOLVABLE;
+}
+
+// ---------------------------------------------------------------------------
+// ------------------------------ Budgets ------------------------------------
+// ---------------------------------------------------------------------------
+
+const char *StatusName(solvestatus status) {
+  switch (status) {
+  case SOLVED:
+    return "Solved!";
+  case UNSOLVABLE:
+    return "Unsolvable";
+  case TIMED_OUT:
+    return "Timed out";
+  }
+  return "";
+}
+
+const char *Outcome(const Sudoku &board, solvestatus status) {
+  if (status == TIMED_OUT)
+    return StatusName(status);
+  return board.Solved() ? "Solved!" : "Unsolved";
+}
+
+Budget::Budget(const limits &l)
+  : limits_(l), nodes_(0), steps_(0), next_check_(0), cutoff_(0),
+    exhausted_(false), cut_off_(false) {
+  clock_gettime(CLOCK_MONOTONIC, &deadline_);
+  double whole = static_cast<long>(l.seconds);
+  deadline_.tv_sec += whole;
+  deadline_.tv_nsec += static_cast<long>((l.seconds - whole) * 1e9);
+  if (deadline_.tv_nsec >= 1000000000) {
+    deadline_.tv_sec++;
+    deadline_.tv_nsec -= 1000000000;
+  }
+}
+
+void Budget::Cutoff(unsigned long nodes) {
+  cutoff_ = nodes ? nodes_ + nodes : 0;
+  if (cut_off_) {
+    // Any real limit reached meanwhile is found again at the next count.
+    cut_off_ = exhausted_ = false;
+    next_check_ = 0;
+  }
+}
+
+void Budget::Check() {
+  if (limits_.cancel && limits_.cancel->load(std::memory_order_relaxed))
+    exhausted_ = true;
+  if (limits_.seconds > 0) {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > deadline_.tv_sec ||
+        (now.tv_sec == deadline_.tv_sec && now.tv_nsec >= deadline_.tv_nsec))
+      exhausted_ = true;
+  }
+}
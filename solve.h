@@ -0,0 +1,300 @@
+#ifndef __SOLVE_HEADER__
+#define __SOLVE_HEADER__
+
+#include <atomic>
+#include <random>
+#include <string>
+#include <vector>
+#include <time.h>
+
+#include "scheduler.h"
+#include "sudoku.h"
+#include "trace.h"
+
+// How a solve ended.
+enum solvestatus {
+  SOLVED,
+  // The puzzle has no solution.
+  UNSOLVABLE,
+  // A limit was reached or the solve was cancelled. The board is left
+  // reduced as far as logic got before guessing.
+  TIMED_OUT
+};
+
+const char *StatusName(solvestatus status);
+
+// Bounds on the work of one solve. Zero means unlimited.
+struct limits {
+  double seconds;
+  unsigned long nodes;
+  unsigned long steps;
+  // Set from another thread, or a signal handler, to stop the solve.
+  const std::atomic<bool> *cancel;
+
+  limits() : seconds(0), nodes(0), steps(0), cancel(NULL) { }
+};
+
+// Counts the work done by a solve against its limits. Counting is a
+// compare per call; the clock and the cancellation flag are only read
+// every CHECK_INTERVAL calls.
+class Budget {
+private:
+  static const unsigned long CHECK_INTERVAL = 1024;
+
+  limits limits_;
+  timespec deadline_;
+  unsigned long nodes_;
+  unsigned long steps_;
+  unsigned long next_check_;
+  unsigned long cutoff_;
+  bool exhausted_;
+  bool cut_off_;
+
+public:
+  explicit Budget(const limits &l);
+
+  // Counts search nodes, more than one for those searched before a
+  // resume. Returns false once the budget is exhausted.
+  bool Node(unsigned long n = 1) {
+    nodes_ += n;
+    if (limits_.nodes && nodes_ > limits_.nodes)
+      exhausted_ = true;
+    if (cutoff_ && nodes_ > cutoff_)
+      exhausted_ = cut_off_ = true;
+    return Tick();
+  }
+  // Counts propagation steps.
+  bool Step(unsigned long n = 1) {
+    steps_ += n;
+    if (limits_.steps && steps_ > limits_.steps)
+      exhausted_ = true;
+    return Tick();
+  }
+
+  // Also exhausts the budget once 'nodes' more nodes are counted, to end
+  // one run of a restarting search. Cutoff(0) lifts the cutoff, and any
+  // new one lifts an exhaustion the old one caused.
+  void Cutoff(unsigned long nodes);
+  bool cut_off() const { return cut_off_; }
+
+  bool exhausted() const { return exhausted_; }
+  unsigned long nodes() const { return nodes_; }
+  unsigned long steps() const { return steps_; }
+
+private:
+  bool Tick() {
+    if (!exhausted_ && nodes_ + steps_ >= next_check_) {
+      next_check_ = nodes_ + steps_ + CHECK_INTERVAL;
+      Check();
+    }
+    return !exhausted_;
+  }
+  void Check();
+};
+
+// How GuessSolve picks the cell to branch on.
+enum branching {
+  // The first cell with the fewest candidates.
+  FEWEST,
+  // Of the cells with the fewest candidates, the one with the most
+  // unsolved peers.
+  FEWEST_BUSIEST
+};
+
+// When a randomized search gives up on a run and starts again.
+enum restartschedule {
+  NO_RESTARTS,
+  // Runs of 1, 1, 2, 1, 1, 2, 4, 1, ... times the first.
+  LUBY,
+  // Each run 'factor' times longer than the last.
+  GEOMETRIC
+};
+
+// A search that breaks ties between the cells to branch on, and orders
+// each cell's guesses, at random. Runs are reproducible from the seed as
+// long as the strategies are too, which adaptive scheduling is not.
+struct randomsearch {
+  unsigned long seed;
+  restartschedule restarts;
+  // Nodes in the first run.
+  unsigned long nodes;
+  double factor;
+
+  randomsearch()
+    : seed(1), restarts(NO_RESTARTS), nodes(100), factor(1.5) { }
+};
+
+// Threads that Probe() shares cells out to; see solve.cpp.
+class ProbePool;
+
+// The optional state of one solve, shared by the solvers.
+struct context {
+  // Strategies stop early without error when the budget runs out, leaving
+  // the board sound but less reduced; check budget->exhausted().
+  Budget *budget;
+  // Chooses and profiles strategies. Without one, LogicSolve runs every
+  // strategy in a fixed order.
+  Scheduler *scheduler;
+  // How many guesses deep the board is.
+  unsigned int depth;
+  // Cells to probe before each guess, none if 0, and the threads to
+  // probe them on.
+  unsigned int probe;
+  unsigned int probe_threads;
+  // Optional. Helper threads for Probe(), which probes on the calling
+  // thread alone without them. A Search makes its own for probe_threads
+  // if none is given, kept for all its nodes.
+  ProbePool *probe_pool;
+  branching branch;
+  // Optional. Solve() searches at random to this policy, drawing from
+  // 'random', which it sets.
+  const randomsearch *randomized;
+  std::mt19937_64 *random;
+  // Optional. Records rounds of logic, strategies, propagation and
+  // guesses, and the candidates left after each round.
+  Tracer *trace;
+  // Runs TEMPLATE along with the other strategies.
+  bool templates;
+
+  context()
+    : budget(NULL), scheduler(NULL), depth(0), probe(0), probe_threads(1),
+      probe_pool(NULL), branch(FEWEST), randomized(NULL), random(NULL),
+      trace(NULL), templates(false) { }
+};
+
+// Removes solved symbols from peers until nothing changes. Returns false if
+// some cell has no symbols left. Each solved cell pushes its symbol out to
+// the peers holding it, and peers it solves are queued to do the same.
+bool AC3(Sudoku &board, Budget *budget = NULL);
+// AC3 after a change to one cell, starting from it if it is solved.
+bool AC3(Sudoku &board, const cell &changed, Budget *budget = NULL);
+// Subset strategies searching subsets of up to 'max_perm_size' cells.
+// If 'by_size' is given, it must have max_perm_size + 1 entries and the
+// number of symbols removed is added to the entry for the subset size.
+// Hidden subsets are found from the board's places.
+bool SearchGroupForHidden(Sudoku &board, unsigned int max_perm_size,
+                          std::vector<unsigned long> *by_size = NULL);
+bool FindMostNakedPerms(Sudoku &board, unsigned int max_perm_size,
+                        std::vector<unsigned long> *by_size = NULL);
+
+// Pointing pairs and box-line reductions, on every pair of units sharing
+// cells. Removals are counted in entry 0 of 'by_size'.
+bool Intersections(Sudoku &board,
+                   std::vector<unsigned long> *by_size = NULL);
+// X-wings, swordfish and larger fish of up to 'max_size' rows or columns.
+bool Fish(Sudoku &board, unsigned int max_size,
+          std::vector<unsigned long> *by_size = NULL);
+
+// Simple coloring of the bilocation links of each symbol.
+bool Coloring(Sudoku &board, std::vector<unsigned long> *by_size = NULL);
+// Chains of strong and weak links: 'kind' is X_CHAIN, XY_CHAIN or AIC.
+// Coloring and chains count removals in entry 0 of 'by_size'.
+bool Chains(Sudoku &board, strategy kind,
+            std::vector<unsigned long> *by_size = NULL);
+// Pattern overlay: a template places a symbol once in every unit, and
+// each symbol is removed from the cells no template within its
+// candidates covers. Boards of up to 9x9 filter a table of every
+// template; larger ones, up to 16x16, search for a template through each
+// candidate. Larger boards are left alone. Counts in entry 0. Sets
+// 'error' if no template of some symbol fits, as then the puzzle has no
+// solution.
+bool Templates(Sudoku &board, bool *error,
+               std::vector<unsigned long> *by_size = NULL);
+
+// Failed-literal probing of the ctx.probe most constrained cells: each
+// candidate is assigned in turn and propagated with AC3, on a trail so it
+// can be undone. Candidates leading to a contradiction are removed, and
+// every cell is restricted to what the candidates left imply between
+// them. Cells are shared out over ctx.probe_threads threads, each
+// stopping when ctx.budget runs out; cells not probed in full are left
+// alone. Returns whether anything was removed, setting 'error' if a cell
+// has no candidate left.
+bool Probe(Sudoku &board, const context &ctx, bool *error);
+
+// Runs one strategy, searching subsets of up to 'max_perm_size' cells,
+// without propagating what it finds. With ctx.scheduler set, the run is
+// profiled on it and the symbols removed are added to 'eliminations'.
+// Sets 'error', if given, when the strategy finds the puzzle has no
+// solution.
+bool Apply(strategy s, Sudoku &board, unsigned int max_perm_size,
+           const context &ctx, unsigned long *eliminations = NULL,
+           bool *error = NULL);
+// Applies strategies until none makes progress. Returns false if the
+// puzzle was found to have no solution.
+bool LogicSolve(Sudoku &board, const context &ctx = context());
+// Solves the puzzle, guessing when logic runs out.
+solvestatus GuessSolve(Sudoku &board, const context &ctx = context());
+
+// GuessSolve as a depth-first search over an explicit stack of the boards
+// guessed on, so it can stop after any node and carry on later: a worker
+// can interleave many searches in slices of a few nodes each. Searches
+// visit the same nodes in the same order as GuessSolve.
+class Search {
+private:
+  // A board that logic left unsolved, and the guesses to make on it.
+  struct frame {
+    Sudoku board;
+    cell guess;
+    std::vector<int> order;
+    std::size_t next;
+
+    explicit frame(const Sudoku &board) : board(board), next(0) { }
+  };
+
+  Sudoku &board_;
+  context ctx_;
+  // The probe helpers the search made, if it was given none.
+  ProbePool *pool_;
+  std::vector<frame> stack_;
+  bool started_;
+  bool finished_;
+  solvestatus status_;
+  unsigned long nodes_;
+
+  Search(const Search &);
+  Search &operator=(const Search &);
+
+public:
+  // Searches 'board', which is reduced in place as GuessSolve would, and
+  // left solved if a solution is found. 'board' and ctx's pointers must
+  // outlive the search.
+  Search(Sudoku &board, const context &ctx);
+  ~Search();
+
+  // Searches at most 'nodes' more nodes. Returns whether the search has
+  // finished.
+  bool Run(unsigned long nodes);
+  bool finished() const { return finished_; }
+  // The outcome, once finished. A search that runs out of budget keeps
+  // its stack, with the node it was in to be searched again, so that it
+  // can still be saved.
+  solvestatus status() const { return status_; }
+  // Nodes searched, counting those before a restore.
+  unsigned long nodes() const { return nodes_; }
+
+  // Checkpoints; see checkpoint.h.
+  friend void SaveSearch(const Search &search, const Sudoku &puzzle,
+                         std::string &state);
+  friend bool RestoreSearch(Search &search, const Sudoku &puzzle,
+                            const std::string &state);
+
+private:
+  // Takes one step: searches a node, or backtracks from a board with no
+  // guesses left. Returns whether a node was searched.
+  bool Step();
+  // Runs logic, and probing, on the board of a node 'depth' guesses deep.
+  // Returns true with the node's status if that settles it, and otherwise
+  // pushes a frame to guess from.
+  bool Expand(Sudoku &board, unsigned int depth, solvestatus *status);
+  void Finish(solvestatus status);
+};
+// GuessSolve in runs cut off and restarted on ctx.randomized's schedule,
+// each from the board as given, until one finishes or the budget runs out.
+solvestatus RandomizedSolve(Sudoku &board, const context &ctx);
+// GuessSolve, or LogicSolve alone if 'logic_only'. Searches at
+// random if ctx.randomized is set.
+solvestatus Solve(Sudoku &board, bool logic_only, const context &ctx);
+// The final line printed for a puzzle after a solve.
+const char *Outcome(const Sudoku &board, solvestatus status);
+
+#endif // __SOLVE_HEADER__
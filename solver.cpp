@@ -1,576 +1,663 @@
-#include <boost/unordered_map.hpp>
-#include <boost/unordered_set.hpp>
+#include <atomic>
+#include <cassert>
+#include <csignal>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
-#include <utility>
-
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "corpus.h"
+#include "pipeline.h"
+#include "portfolio.h"
+#include "session.h"
+#include "shard.h"
+#include "solve.h"
 #include "sudoku.h"
+#include "verify.h"
 
 using namespace std;
 
-typedef boost::unordered_map<int, cellset> symmap;
-
-template <typename T>
-struct reversemap {
-  typedef boost::unordered_map<T, symmap> t;
-};
+void print_usage() {
+  cout << "Sudoku Solver\n" << endl;
+  cout << "solver [--logic] [limits] [scheduling] [search] [--threads n]\n";
+  cout << "       [--trace file] puzzle\n";
+  cout << "solver [limits] [scheduling] [--probe n] [--threads n]\n";
+  cout << "       [--checkpoint-every seconds] --checkpoint|--resume file\n";
+  cout << "       puzzle\n";
+  cout << "solver --portfolio [limits] [scheduling] [--trace file] puzzle\n";
+  cout << "solver [--logic] [limits] [scheduling] [search] [--threads n]\n";
+  cout << "       [--interleave n [--slice k]] [--trace file]\n";
+  cout << "       --corpus corpus [index]\n";
+  cout << "solver --shards n [--shard-size n] [--pin] [--logic] [limits]\n";
+  cout << "       [--adaptive] [search] [--threads n]\n";
+  cout << "       [--interleave n [--slice k]]\n";
+  cout << "       --corpus corpus [index]\n";
+  cout << "solver --hint puzzle\n";
+  cout << "solver --pack corpus puzzle...\n";
+  cout << "solver --verify puzzle solution\n";
+  cout << "solver --verify [--threads n] --corpus corpus [index]\n" << endl;
+  cout << "Solves the Sudoku puzzle, guessing if necessary. If the --logic\n";
+  cout << "flag is provided, the solver will only use logic to try to solve\n";
+  cout << "the puzzle, though it may be unable to completely solve it.\n\n";
+  cout << "Puzzle rows are one character per cell, or whitespace separated\n";
+  cout << "tokens for boards larger than 64x64 (symbols 1 to N).\n";
+  cout << "The rows of a puzzle may be followed by variant lines: 'diagonal'\n";
+  cout << "and 'windoku' add units, and 'jigsaw' followed by a row of region\n";
+  cout << "labels per board row replaces the blocks.\n\n";
+  cout << "--corpus solves every puzzle in a packed corpus, or only the one\n";
+  cout << "at 'index'. --pack converts puzzle files into a packed corpus,\n";
+  cout << "including their solutions if every puzzle has a .solved file.\n";
+  cout << "A corpus is solved on n threads, one per core by default, and its\n";
+  cout << "boards are printed in corpus order.\n";
+  cout << "--interleave n has each solver thread search n puzzles at once,\n";
+  cout << "taking turns of k search nodes (--slice, 32 by default), so\n";
+  cout << "easy puzzles are not held up behind hard ones; a --timeout then\n";
+  cout << "counts the turns of the others too. Logic alone and --seed runs\n";
+  cout << "are not interleaved. With --stats, the 50th and 99th percentile\n";
+  cout << "times from reading a puzzle to solving it are printed.\n\n";
+  cout << "--shards n solves a corpus on n processes instead, each taking\n";
+  cout << "shards of --shard-size puzzles in turn on --threads threads (the\n";
+  cout << "cores shared out by default), and prints only a summary. Shards\n";
+  cout << "that straggle are also given to an idle process, and the shards\n";
+  cout << "of a process that dies are given to the others. --pin pins\n";
+  cout << "process k to NUMA node k.\n\n";
+  cout << "--hint prints the simplest next deduction from the puzzle: the\n";
+  cout << "strategy, with its subset size, and the cells it solves and the\n";
+  cout << "candidates it removes, as rows and columns from 1.\n\n";
+  cout << "--verify checks a solution against its puzzle, or the solutions\n";
+  cout << "stored in a corpus on n threads, reporting the first unit or\n";
+  cout << "cell at fault.\n";
+  cout << "A solution file is in the puzzle format or a .solved dump.\n\n";
+  cout << "Limits, per puzzle: --timeout seconds, --nodes guesses, --steps\n";
+  cout << "propagation steps. A puzzle hitting a limit, or interrupted with\n";
+  cout << "Ctrl-C, is reported as timed out with its partly reduced board.\n";
+  cout << "Ctrl-C also stops a corpus run after the puzzles in progress.\n\n";
+  cout << "Scheduling: --adaptive orders strategies and bounds subset sizes\n";
+  cout << "by what they have paid off so far, --profile file loads and saves\n";
+  cout << "that record between runs, and --stats prints it at the end.\n";
+  cout << "--templates also removes the candidates of each symbol that no\n";
+  cout << "placement of it in every unit covers, on boards up to 16x16.\n\n";
+  cout << "Search: --probe n, --seed n, --restarts luby|geometric,\n";
+  cout << "--restart-nodes n.\n";
+  cout << "--probe n tries each candidate of the n most constrained cells\n";
+  cout << "before every guess, removing those that fail. A single puzzle is\n";
+  cout << "probed on --threads threads; in a corpus each solver thread\n";
+  cout << "probes alone.\n";
+  cout << "--seed n breaks ties between cells to guess, and orders guesses,\n";
+  cout << "at random from n. --restarts starts the search again from the\n";
+  cout << "puzzle whenever a run uses up its nodes: --restart-nodes n (100\n";
+  cout << "by default) times the Luby sequence 1, 1, 2, 1, 1, 2, 4, ... or\n";
+  cout << "growing by half each run. A corpus seeds puzzle k with n + k.\n\n";
+  cout << "--checkpoint file saves the state of the search to 'file'\n";
+  cout << "every few seconds (--checkpoint-every, 5 by default) and when\n";
+  cout << "it is interrupted or times out. --resume file continues the\n";
+  cout << "search of the same puzzle from there, saving to it as it goes.\n";
+  cout << "--nodes counts the nodes searched before resuming too, while\n";
+  cout << "--timeout and --steps apply to each run. The file is removed\n";
+  cout << "once the search finishes.\n\n";
+  cout << "--portfolio races several solver configurations on a thread each,\n";
+  cout << "keeping the first to finish. With --stats or --profile, the\n";
+  cout << "winner is counted per board size.\n\n";
+  cout << "--trace file records a timeline of the solve, in the Chrome\n";
+  cout << "trace-event format for chrome://tracing or Perfetto: rounds of\n";
+  cout << "logic, strategies, propagation, guesses and the candidates left.";
+  cout << endl;
+  exit(0);
+}
 
-enum grouptype {
-  NONE,
-  ROW,
-  COL,
-  BLK
+struct options {
+  bool logic;
+  bool corpus;
+  bool pack;
+  bool verify;
+  bool adaptive;
+  bool stats;
+  bool portfolio;
+  bool hint;
+  bool randomized;
+  bool pin;
+  bool templates;
+  bool threads_set;
+  randomsearch search;
+  long index;
+  unsigned int threads;
+  unsigned int probe;
+  unsigned int shards;
+  size_t shard_size;
+  unsigned int interleave;
+  unsigned long slice;
+  limits lim;
+  const char *profile;
+  const char *trace;
+  const char *checkpoint;
+  double checkpoint_every;
+  bool resume;
+  // Shared by every puzzle of a run, so corpus runs learn as they go.
+  Scheduler *scheduler;
+  Tracer *tracer;
+  vector<char *> paths;
 };
 
-template <typename InputIterator>
-void print_container(InputIterator first, InputIterator last) {
-  cout << '{';
-  for (; first != last; ++first)
-    cout << *first << ',';
-  cout << '}' << endl;
-}
+// Set by Ctrl-C to cancel the solve in progress.
+static atomic<bool> interrupted (false);
 
-template <typename T>
-bool erase_all(boost::unordered_set<T> &s1,
-               const boost::unordered_set<T> &s2) {
-  bool erased = false;
-  for (typename boost::unordered_set<T>::const_iterator it = s2.begin();
-       it != s2.end(); ++it)
-    if (s1.erase(*it) > 0)
-      erased = true;
-  return erased;
-}
-
-template <typename T>
-bool subsetof(const boost::unordered_set<T> &s1,
-              const boost::unordered_set<T> &s2) {
-  for (typename boost::unordered_set<T>::const_iterator it = s1.begin();
-       it != s1.end(); ++it)
-    if (s2.find(*it) == s2.end())
-      return false;
-  return true;
+void interrupt(int) {
+  interrupted.store(true);
 }
 
-// ---------------------------------------------------------------------------
-// -------------------------------- AC3 --------------------------------------
-// ---------------------------------------------------------------------------
-
-bool ArcReduce(Sudoku &board, const cell &c, bool *error) {
-  bool change = false;
-  symset &dom = board[c];
-  const vector<cell> &conf = board.conflicting(c);
-  for (vector<cell>::const_iterator it = conf.begin();
-       it != conf.end(); ++it) {
-    const symset &dom2 = board[*it];
-    if (dom2.size() == 1) {
-      if (dom.erase(*dom2.begin()) > 0)
-        change = true;
+options process_args(int argc, char **argv) {
+  options opts;
+  opts.logic = opts.corpus = opts.pack = opts.verify = false;
+  opts.adaptive = opts.stats = opts.portfolio = opts.randomized = false;
+  opts.pin = opts.threads_set = opts.hint = opts.templates = false;
+  opts.index = -1;
+  opts.threads = max(1u, thread::hardware_concurrency());
+  opts.probe = opts.shards = 0;
+  opts.shard_size = 0;
+  opts.interleave = 1;
+  opts.slice = 0;
+  opts.profile = opts.trace = opts.checkpoint = NULL;
+  opts.checkpoint_every = 5;
+  opts.resume = false;
+  opts.scheduler = NULL;
+  opts.tracer = NULL;
+  opts.lim.cancel = &interrupted;
+  for (int i = 1; i < argc; i++) {
+    bool more = i + 1 < argc;
+    if (strcmp(argv[i], "--logic") == 0)
+      opts.logic = true;
+    else if (strcmp(argv[i], "--timeout") == 0 && more)
+      opts.lim.seconds = atof(argv[++i]);
+    else if (strcmp(argv[i], "--nodes") == 0 && more)
+      opts.lim.nodes = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--steps") == 0 && more)
+      opts.lim.steps = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--adaptive") == 0)
+      opts.adaptive = true;
+    else if (strcmp(argv[i], "--stats") == 0)
+      opts.stats = true;
+    else if (strcmp(argv[i], "--templates") == 0)
+      opts.templates = true;
+    else if (strcmp(argv[i], "--profile") == 0 && more)
+      opts.profile = argv[++i];
+    else if (strcmp(argv[i], "--threads") == 0 && more) {
+      opts.threads = max(1l, atol(argv[++i]));
+      opts.threads_set = true;
     }
-  }
-  if (dom.size() == 0)
-    *error = true;
-  return change;
-}
-
-bool AC3(Sudoku &board) {
-  cellset todo;
-  for (int i = 0; i < board.length(); i++) {
-    for (int j = 0; j < board.length(); j++) {
-      if (board[i][j].size() == 0)
-        return false;
-      todo.insert(cell(i, j));
+    else if (strcmp(argv[i], "--probe") == 0 && more)
+      opts.probe = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--seed") == 0 && more) {
+      opts.randomized = true;
+      opts.search.seed = strtoul(argv[++i], NULL, 10);
     }
-  }
-  while (!todo.empty()) {
-    cell c = *todo.begin();
-    todo.erase(todo.begin());
-    bool error = false;
-    bool change = ArcReduce(board, c, &error);
-    if (error)
-      return false;
-    if (change) {
-      const vector<cell> &conf = board.conflicting(c);
-      todo.insert(conf.begin(), conf.end());
+    else if (strcmp(argv[i], "--restarts") == 0 && more) {
+      opts.randomized = true;
+      string schedule = argv[++i];
+      if (schedule == "luby")
+        opts.search.restarts = LUBY;
+      else if (schedule == "geometric")
+        opts.search.restarts = GEOMETRIC;
+      else
+        print_usage();
     }
+    else if (strcmp(argv[i], "--restart-nodes") == 0 && more)
+      opts.search.nodes = max(1ul, strtoul(argv[++i], NULL, 10));
+    else if (strcmp(argv[i], "--trace") == 0 && more)
+      opts.trace = argv[++i];
+    else if (strcmp(argv[i], "--shards") == 0 && more)
+      opts.shards = max(1l, atol(argv[++i]));
+    else if (strcmp(argv[i], "--shard-size") == 0 && more)
+      opts.shard_size = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--interleave") == 0 && more)
+      opts.interleave = max(1l, atol(argv[++i]));
+    else if (strcmp(argv[i], "--slice") == 0 && more)
+      opts.slice = max(1ul, strtoul(argv[++i], NULL, 10));
+    else if (strcmp(argv[i], "--checkpoint") == 0 && more)
+      opts.checkpoint = argv[++i];
+    else if (strcmp(argv[i], "--resume") == 0 && more) {
+      opts.checkpoint = argv[++i];
+      opts.resume = true;
+    }
+    else if (strcmp(argv[i], "--checkpoint-every") == 0 && more)
+      opts.checkpoint_every = atof(argv[++i]);
+    else if (strcmp(argv[i], "--pin") == 0)
+      opts.pin = true;
+    else if (strcmp(argv[i], "--hint") == 0)
+      opts.hint = true;
+    else if (strcmp(argv[i], "--portfolio") == 0)
+      opts.portfolio = true;
+    else if (strcmp(argv[i], "--corpus") == 0)
+      opts.corpus = true;
+    else if (strcmp(argv[i], "--pack") == 0)
+      opts.pack = true;
+    else if (strcmp(argv[i], "--verify") == 0)
+      opts.verify = true;
+    else if (strncmp(argv[i], "--", 2) == 0)
+      print_usage();
+    else
+      opts.paths.push_back(argv[i]);
   }
-  return true;
-}
-
-// ---------------------------------------------------------------------------
-// ----------------------------- Swordfish -----------------------------------
-// ---------------------------------------------------------------------------
-
-template <typename T>
-pair<T, T> set2_to_pair(const boost::unordered_set<T> &set) {
-  pair<T, T> p;
-  for (typename boost::unordered_set<T>::const_iterator it = set.begin();
-       it != set.end(); ++it) {
-    p.first = *it;
-    ++it;
-    p.second = *it;
+  if (opts.corpus + opts.pack > 1 || opts.pack + opts.verify > 1 ||
+      ((opts.pack || opts.verify) && opts.logic) ||
+      (opts.portfolio && (opts.logic || opts.corpus || opts.pack ||
+                          opts.verify || opts.randomized ||
+                          opts.templates)) ||
+      (opts.shards && (!opts.corpus || opts.verify || opts.trace ||
+                       opts.profile || opts.stats)) ||
+      (!opts.shards && (opts.pin || opts.shard_size)) ||
+      ((opts.interleave > 1 || opts.slice) &&
+       (!opts.corpus || opts.verify || opts.trace)) ||
+      (opts.slice && opts.interleave < 2) ||
+      (opts.checkpoint && (opts.logic || opts.corpus || opts.pack ||
+                           opts.verify || opts.portfolio || opts.hint ||
+                           opts.randomized)) ||
+      (opts.hint && (opts.logic || opts.corpus || opts.pack || opts.verify ||
+                     opts.portfolio)))
+    print_usage();
+  if (opts.pack) {
+    if (opts.paths.size() < 2)
+      print_usage();
   }
-  return p;
-}
-
-template <grouptype TYPE>
-bool CheckSwordfish(Sudoku &board,
-                    const boost::unordered_set<pair<cell, cell> > &corners);
-
-// Check this set of cells for a swordfish
-// Want exactly two indices for column as well
-template <>
-bool CheckSwordfish<ROW>(Sudoku &board,
-                         const boost::unordered_set<pair<cell, cell> > &corners) {
-  bool change = false;
-  boost::unordered_set<unsigned int> safeI;
-  boost::unordered_map<unsigned int, int> foundJ;
-  for (boost::unordered_set<pair<cell, cell> >::const_iterator it = corners.begin();
-       it != corners.end(); ++it) {
-    foundJ[it->second.j]++;
-    // TODO
+  else if (opts.verify && !opts.corpus) {
+    if (opts.paths.size() != 2)
+      print_usage();
   }
-  return change;
-}
-
-// Check this set of cells for a swordfish
-// Want exactly two indices for row as well
-template <>
-bool CheckSwordfish<COL>(Sudoku &board,
-                         const boost::unordered_set<pair<cell, cell> > &corners) {
-  bool change = false;
-  return change;
-}
-  
-
-template <grouptype TYPE>
-bool SwordfishGroup(Sudoku &board, const reversemap<unsigned int>::t &grpmap) {
-  bool change = false;
-  symset done;
-  for (reversemap<unsigned int>::t::const_iterator it = grpmap.begin();
-       it != grpmap.end(); ++it) {
-    //unsigned int x = it->first;
-    const symmap &smap = it->second;
-    for (symmap::const_iterator it2 = smap.begin(); it2 != smap.end(); ++it2) {
-      int sym = it2->first;
-      if (done.find(sym) != done.end())
-        continue;
-      done.insert(sym);
-      const cellset &cells = it2->second;
-      if (cells.size() != 2)
-        continue;
-      // Find the rest of the groups where this symbol appears twice
-      boost::unordered_set<pair<cell, cell> > corners;
-      corners.insert(set2_to_pair(cells));
-      reversemap<unsigned int>::t::const_iterator it3 = it;
-      for (++it3; it3 != grpmap.end(); ++it3) {
-        symmap::const_iterator map_it = it->second.find(sym);
-        if (map_it != it->second.end() && map_it->second.size() == 2)
-          corners.insert(set2_to_pair(map_it->second));
-      }
-      change |= CheckSwordfish<TYPE>(board, corners);
-    }
+  else if (opts.corpus) {
+    if (opts.paths.size() == 2)
+      opts.index = atol(opts.paths[1]);
+    else if (opts.paths.size() != 1)
+      print_usage();
   }
-  return change;
+  else if (opts.paths.size() != 1)
+    print_usage();
+  return opts;
 }
 
-bool Swordfish(Sudoku &board, const reversemap<unsigned int>::t &rowmap,
-               const reversemap<unsigned int>::t &colmap) {
-  bool change = false;
-  change |= SwordfishGroup<ROW>(board, rowmap);
-  change |= SwordfishGroup<COL>(board, colmap);
-  return change;
+context Context(const options &opts, Budget *budget) {
+  context ctx;
+  ctx.budget = budget;
+  ctx.scheduler = opts.scheduler;
+  ctx.probe = opts.probe;
+  ctx.probe_threads = opts.threads;
+  ctx.trace = opts.tracer;
+  ctx.templates = opts.templates;
+  if (opts.randomized)
+    ctx.randomized = &opts.search;
+  return ctx;
 }
 
-// ---------------------------------------------------------------------------
-// --------------------------- Symbol Removal --------------------------------
-// ---------------------------------------------------------------------------
-
-struct groups {
-  unsigned int row;
-  unsigned int col;
-  cell blk;
-};
-
-groups SameGroup(const Sudoku &board, const cellset &cells,
-                 bool *row, bool *col, bool *blk) {
-  groups g;
-  if (cells.size() == 0) {
-    *row = *col = *blk = false;
-    return g;
-  }
-  cellset::const_iterator it = cells.begin();
-  cell c = *it;
-  g.row = c.i;
-  g.col = c.j;
-  g.blk = board.corner(c);
-  *row = *col = *blk = true;
-  for (++it; it != cells.end(); ++it) {
-    cell c2 = *it;
-    if (g.row != c2.i)
-      *row = false;
-    if (g.col != c2.j)
-      *col = false;
-    if (g.blk != board.corner(c2))
-      *blk = false;
-  }
-  return g;
+solvestatus Solve(Sudoku &s, const options &opts) {
+  Budget budget (opts.lim);
+  return Solve(s, opts.logic, Context(opts, &budget));
 }
 
-// Removes the symbols 'syms' from all other cells in the same
-// group as 'cells'.
-// If the symbols have already been removed from a group, pass ROW, COL,
-// or BLK as appropriate as 'type'. Otherwise, pass NONE.
-bool RemoveSymsFromOtherCells(Sudoku &board, const cellset &cells,
-                              const symset &syms, grouptype done) {
-  bool change = false;
-  bool row, col, blk;
-  groups g = SameGroup(board, cells, &row, &col, &blk);
-  if (row && done != ROW) {
-    for (int j = 0; j < board.length(); j++) {
-      if (cells.find(cell(g.row, j)) == cells.end())
-        change |= erase_all(board[g.row][j], syms);
-    }
-  }
-  if (col && done != COL) {
-    for (int i = 0; i < board.length(); i++) {
-      if (cells.find(cell(i, g.col)) == cells.end())
-        change |= erase_all(board[i][g.col], syms);
-    }
-  }
-  if (blk && done != BLK) {
-    ITERBLOCK(i, j, board, g.blk) {
-      if (cells.find(cell(i, j)) == cells.end())
-        change |= erase_all(board[i][j], syms);
-    }
+// Searches with checkpoints, from the last one if resuming. Returns false
+// if the checkpoint is not one of this puzzle.
+bool SolveCheckpointed(Sudoku &s, const options &opts, solvestatus *status) {
+  Budget budget (opts.lim);
+  Sudoku puzzle = s.Clone();
+  Search search (s, Context(opts, &budget));
+  if (opts.resume) {
+    string state;
+    if (!ReadCheckpoint(opts.checkpoint, state) ||
+        !RestoreSearch(search, puzzle, state))
+      return false;
+    // --nodes bounds the whole search, not each run of it.
+    budget.Node(search.nodes());
+    cout << "Resumed after " << search.nodes() << " nodes" << endl;
   }
-  return change;
+  Checkpointer saver (opts.checkpoint);
+  *status = RunCheckpointed(search, puzzle, saver, opts.checkpoint_every);
+  // Waits for the last checkpoint to be written.
+  int error = saver.Close();
+  if (*status != TIMED_OUT)
+    unlink(opts.checkpoint);
+  else if (error)
+    cerr << "Cannot write " << opts.checkpoint << ": " << strerror(error)
+         << ", so it holds an earlier checkpoint, if any" << endl;
+  return true;
 }
 
-// ---------------------------------------------------------------------------
-// ------------------------- Naked Permutations ------------------------------
-// ---------------------------------------------------------------------------
-
-// Checks to see whether cell 'c' with domain 'dom' is a superset of a
-// naked permutation in a group (which is given by 'TYPE').
-template <grouptype TYPE>
-bool SearchGroupForNaked(Sudoku &board, cellset &done, const symset &dom,
-                         const cell &c) {
-  if (done.find(c) == done.end()) {
-    cellset found;
-    found.insert(c);
-    for (int x = 0; x < board.length(); x++) {
-      cell c2 (c);
-      if (TYPE == ROW)
-        c2.j = x;
-      else if (TYPE == COL)
-        c2.i = x;
-      if (board[c2].size() == 1)
-        continue;
-      if (c2 != c && done.find(c2) == done.end() &&
-          subsetof(board[c2], dom)) {
-        found.insert(c2);
-      }
+// Packs each puzzle as it is read, so a corpus of any size is packed in
+// little memory.
+int Pack(const options &opts) {
+  bool solved = true;
+  for (int i = 1; solved && i < opts.paths.size(); i++)
+    solved = access((string(opts.paths[i]) + ".solved").c_str(), R_OK) == 0;
+  CorpusWriter *out = NULL;
+  const Topology *first = NULL;
+  for (int i = 1; i < opts.paths.size(); i++) {
+    ifstream puzzle (opts.paths[i], ifstream::in);
+    tokengrid givens = Sudoku::ReadRows(puzzle);
+    const Topology *topology = Topology::Parse(givens.size(), puzzle);
+    assert(first == NULL || topology == first);
+    if (out == NULL) {
+      first = topology;
+      out = new CorpusWriter(opts.paths[0], topology, solved);
     }
-    if (found.size() == dom.size()) {
-      done.insert(found.begin(), found.end());
-      return RemoveSymsFromOtherCells(board, found, dom, NONE);
+    tokengrid solution;
+    if (solved &&
+        !corpus::ReadSolvedRows(string(opts.paths[i]) + ".solved",
+                                givens.size(), solution)) {
+      cout << "Cannot read " << opts.paths[i] << ".solved" << endl;
+      delete out;
+      return 1;
     }
+    out->Add(givens, solved ? &solution : NULL);
   }
-  return false;
+  size_t packed = out->size();
+  delete out;
+  cout << "Packed " << packed << " puzzles"
+       << (solved ? " with solutions" : "") << endl;
+  return 0;
 }
 
-// Checks to see whether cell 'c' with domain 'dom' is a superset of a
-// naked permutation in a group (which is given by 'TYPE').
-template <>
-bool SearchGroupForNaked<BLK>(Sudoku &board, cellset &done, const symset &dom,
-                              const cell &c) {
-  if (done.find(c) == done.end()) {
-    done.insert(c);
-    cellset found;
-    found.insert(c);
-    cell cnr = board.corner(c);
-    ITERBLOCK(i2, j2, board, cnr) {
-      cell c2 (i2, j2);
-      if (board[c2].size() == 1)
-        continue;
-      if (c2 != c && done.find(c2) == done.end() &&
-          subsetof(board[c2], dom)) {
-        found.insert(c2);
-      }
-    }
-    if (found.size() == dom.size()) {
-      done.insert(found.begin(), found.end());
-      return RemoveSymsFromOtherCells(board, found, dom, NONE);
-    }
+int Verify(const options &opts) {
+  ifstream puzzle (opts.paths[0], ifstream::in);
+  tokengrid given = Sudoku::ReadRows(puzzle);
+  const Topology *topology = Topology::Parse(given.size(), puzzle);
+  const Alphabet &alphabet = Sudoku(given, topology).alphabet();
+  unsigned int length = topology->length();
+  tokengrid solved;
+  if (!corpus::ReadSolvedRows(opts.paths[1], length, solved)) {
+    ifstream solution (opts.paths[1], ifstream::in);
+    solved = Sudoku::ReadRows(solution);
   }
-  return false;
-}
-/**
- * for each cell c of size k:
- *   find other cells c' with D(c) = D(c')
- *   if k cells total, naked exact perm
- *
- * Misses perms like (2,3),(3,4),(2,4)
- * Catches (2,4),(2,4) or (2,3,4),(2,3,4),(2,3,4) or (2,3,4),(2,3),(3,4)
- */
-bool FindMostNakedPerms(Sudoku &board, unsigned int max_perm_size) {
-  bool change = false;
-  // This keeps track of whether a cell needs to be searched for perms
-  // in its row, column, or block.
-  cellset doneR;
-  cellset doneC;
-  cellset doneB;
-  const vector<cell> &cells = board.OrderedCells();
-  for (vector<cell>::const_iterator it = cells.begin();
-       it != cells.end(); ++it) {
-    cell c = *it;
-    const symset &dom = board[c];
-    int k = dom.size();
-    if (k == 1 || k > max_perm_size)
-      continue;
-
-    change |= SearchGroupForNaked<ROW>(board, doneR, dom, c);
-    change |= SearchGroupForNaked<COL>(board, doneC, dom, c);
-    change |= SearchGroupForNaked<BLK>(board, doneB, dom, c);
+  if (solved.size() != length) {
+    cout << "Invalid: " << opts.paths[1] << " has " << solved.size()
+         << " rows rather than " << length << endl;
+    return 1;
   }
-  return change;
-}
-
-// ---------------------------------------------------------------------------
-// ------------------------- Hidden Permutations -----------------------------
-// ---------------------------------------------------------------------------
-
-void MakeReverseMaps(const Sudoku &board,
-                     reversemap<unsigned int>::t &rowmap,
-                     reversemap<unsigned int>::t &colmap,
-                     reversemap<cell>::t &blkmap) {
-  for (int i = 0; i < board.length(); i++) {
-    symmap &mapR = rowmap[i];
-    for (int j = 0; j < board.length(); j++) {
-      symmap &mapC = colmap[j];
-      symmap &mapB = blkmap[board.corner(i, j)];
-      const symset &dom = board[i][j];
-      if (dom.size() == 1)
-        continue;
-      cell c = cell(i, j);
-      for (symset::const_iterator it = dom.begin(); it != dom.end(); ++it) {
-        mapR[*it].insert(c);
-        mapC[*it].insert(c);
-        mapB[*it].insert(c);
-      }
+  // Unknowns are code 0 and tokens outside the alphabet are past its end.
+  vector<unsigned int> givens, codes;
+  for (int i = 0; i < length; i++) {
+    for (int j = 0; j < length; j++) {
+      givens.push_back(alphabet.Find(given[i][j]) + 1);
+      string tok = j < solved[i].size() ? solved[i][j] : "";
+      int sym = alphabet.Find(tok);
+      codes.push_back(sym >= 0 ? sym + 1 :
+                      tok == string(1, Sudoku::unknown) ? 0 : length + 1);
     }
   }
+  Verifier verifier (topology);
+  verdict v = verifier.Check(&givens[0], &codes[0]);
+  if (v.valid())
+    cout << "Valid" << endl;
+  else
+    cout << "Invalid: " << verifier.Describe(v, alphabet.tokens()) << endl;
+  return v.valid() ? 0 : 1;
 }
 
-// Delete all but the symbols in 'syms' from the cells in 'perm'.
-bool ProcessHiddenPerm(Sudoku &board, const cellset &perm,
-                       const symset &syms) {
-  bool change = false;
-  for (cellset::const_iterator it = perm.begin(); it != perm.end(); ++it) {
-    symset &dom = board[*it];
-    symset::iterator it2 = dom.begin();
-    while (it2 != dom.end()) {
-      if (syms.find(*it2) == syms.end()) {
-        it2 = dom.erase(it2);
-        change = true;
-      }
-      else
-        ++it2;
+// Opens the corpus and finds the puzzles of it to use: all of them, or
+// the one at the index. Returns false, saying why, if the corpus cannot
+// be read or has no puzzle at the index.
+bool OpenRange(Corpus &puzzles, const options &opts, size_t *first,
+               size_t *last) {
+  string error;
+  if (!puzzles.Open(opts.paths[0], &error)) {
+    cout << "Cannot read " << opts.paths[0] << ": " << error << endl;
+    return false;
+  }
+  *first = 0;
+  *last = puzzles.size();
+  if (opts.index >= 0) {
+    if (opts.index >= puzzles.size()) {
+      cout << opts.paths[0] << " holds " << puzzles.size()
+           << " puzzles, so none at " << opts.index << endl;
+      return false;
     }
+    *first = opts.index;
+    *last = *first + 1;
   }
-  return change;
+  return true;
 }
 
-template <grouptype T>
-struct MapKey {
-  typedef unsigned int key;
-};
-
-template <>
-struct MapKey<BLK> {
-  typedef cell key;
-};
-
-template <grouptype TYPE>
-struct Map {
-  typedef typename reversemap<typename MapKey<TYPE>::key>::t t;
-};
-
-template <grouptype TYPE>
-void FindOtherSyms(const Sudoku &board, const cellset &cells,
-                   symset &others, typename MapKey<TYPE>::key x);
-
-template <>
-void FindOtherSyms<ROW>(const Sudoku &board, const cellset &cells,
-                        symset &others, MapKey<ROW>::key i) {
-  for (int j = 0; j < board.length(); j++) {
-    if (cells.find(cell(i, j)) == cells.end())
-      others.insert(board[i][j].begin(), board[i][j].end());
+// Verifies puzzles first to last - 1, describing each failure by index.
+void VerifyRange(const Corpus &puzzles, size_t first, size_t last,
+                 vector<pair<size_t, string> > *failures) {
+  Verifier verifier (puzzles.topology());
+  unsigned int cells = puzzles.length() * puzzles.length();
+  vector<unsigned int> givens (cells), codes (cells);
+  for (size_t k = first; k < last; k++) {
+    puzzles.GivenCodes(k, &givens[0]);
+    puzzles.SolutionCodes(k, &codes[0]);
+    verdict v = verifier.Check(&givens[0], &codes[0]);
+    if (!v.valid())
+      failures->push_back(make_pair(k, verifier.Describe(v,
+                                                         puzzles.alphabet())));
   }
 }
 
-template <>
-void FindOtherSyms<COL>(const Sudoku &board, const cellset &cells,
-                        symset &others, MapKey<COL>::key j) {
-  for (int i = 0; i < board.length(); i++) {
-    if (cells.find(cell(i, j)) == cells.end())
-      others.insert(board[i][j].begin(), board[i][j].end());
+int VerifyCorpus(const options &opts) {
+  Corpus puzzles;
+  size_t first, last;
+  if (!OpenRange(puzzles, opts, &first, &last))
+    return 1;
+  if (!puzzles.has_solutions()) {
+    cout << opts.paths[0] << " holds no solutions to verify" << endl;
+    return 1;
   }
-}
-
-template <>
-void FindOtherSyms<BLK>(const Sudoku &board,  const cellset &cells,
-                        symset &others, MapKey<BLK>::key c) {
-  ITERBLOCK(i, j, board, c) {
-    if (cells.find(cell(i, j)) == cells.end())
-      others.insert(board[i][j].begin(), board[i][j].end());
+  // Contiguous shares, so failures come back in corpus order.
+  vector<vector<pair<size_t, string> > > failures (opts.threads);
+  vector<thread> threads;
+  for (int t = 0; t < opts.threads; t++) {
+    size_t from = first + (last - first) * t / opts.threads;
+    size_t to = first + (last - first) * (t + 1) / opts.threads;
+    threads.push_back(thread(VerifyRange, ref(puzzles), from, to,
+                             &failures[t]));
   }
-}
-
-/** 
- * for each sym s:
- *   find c_1,...,c_k s.t. s in D(c)
- *   if union of c_i minus the rest of the group has size k:
- *     we have a hidden perm
- *
- * This will catch the case where a symbol can only go in one cell
- */
-template <grouptype TYPE>
-bool SearchGroupForHidden(Sudoku &board, unsigned int max_perm_size,
-                          const typename Map<TYPE>::t &grpmap) {
-  bool change = false;
-  for (typename Map<TYPE>::t::const_iterator it = grpmap.begin();
-       it != grpmap.end(); ++it) {
-    typename MapKey<TYPE>::key x = it->first;
-    const symmap &smap = it->second;
-    for (symmap::const_iterator it2 = smap.begin(); it2 != smap.end(); ++it2) {
-      int sym = it2->first;
-      const cellset &cells = it2->second;
-      int k = cells.size();
-      if (k <= board.blocksize()) {
-        symset singleton;
-        singleton.insert(sym);
-        change |= RemoveSymsFromOtherCells(board, cells, singleton, TYPE);
-      }
-      if (k > max_perm_size)
-        continue;
-      // (union of cells) \ (union of not cells)
-      // if that size is k, we're in business
-      symset others;
-      FindOtherSyms<TYPE>(board, cells, others, x);      
-      symset these;
-      for (cellset::const_iterator it3 = cells.begin();
-           it3 != cells.end(); ++it3)
-        these.insert(board[*it3].begin(), board[*it3].end());
-      erase_all(these, others);
-      if (these.size() == k) {
-        // delete everything from cells not in these
-        // check whether naked perm in other group
-        change |= ProcessHiddenPerm(board, cells, these);
-      }
-    }
+  size_t invalid = 0;
+  for (int t = 0; t < threads.size(); t++) {
+    threads[t].join();
+    for (int f = 0; f < failures[t].size(); f++)
+      cout << "#" << failures[t][f].first << " invalid: "
+           << failures[t][f].second << "\n";
+    invalid += failures[t].size();
   }
-  return change;
+  cout << "Valid " << last - first - invalid << "/" << last - first << endl;
+  return invalid == 0 ? 0 : 1;
 }
 
-// Looks for hidden permutations and swordfish. These are in the same
-// function because they both make use of the symbol maps.
-bool HiddenAndSwordfish(Sudoku &board, unsigned int max_perm_size) {
-  bool change = false;
-  reversemap<unsigned int>::t rowmap;
-  reversemap<unsigned int>::t colmap;
-  reversemap<cell>::t blkmap;
-  MakeReverseMaps(board, rowmap, colmap, blkmap);
-  
-  change |= SearchGroupForHidden<ROW>(board, max_perm_size, rowmap);
-  change |= SearchGroupForHidden<COL>(board, max_perm_size, colmap);
-  change |= SearchGroupForHidden<BLK>(board, max_perm_size, blkmap);
 
-  //change |= Swordfish(board, rowmap, colmap);
-  
-  return change;
+batchoptions Batch(const options &opts) {
+  batchoptions batch;
+  batch.logic = opts.logic;
+  batch.lim = opts.lim;
+  batch.threads = opts.threads;
+  batch.probe = opts.probe;
+  batch.interleave = opts.interleave;
+  batch.templates = opts.templates;
+  if (opts.slice)
+    batch.slice = opts.slice;
+  if (opts.randomized)
+    batch.randomized = &opts.search;
+  batch.scheduler = opts.scheduler;
+  batch.trace = opts.tracer;
+  return batch;
 }
 
-// ---------------------------------------------------------------------------
-// ------------------------------ Solvers ------------------------------------
-// ---------------------------------------------------------------------------
+int SolveCorpus(const options &opts) {
+  Corpus puzzles;
+  size_t first, last;
+  if (!OpenRange(puzzles, opts, &first, &last))
+    return 1;
+  batchoptions batch = Batch(opts);
+  cout.flush();
+  batchresult result = SolveBatch(puzzles, first, last, batch, STDOUT_FILENO);
+  if (result.error) {
+    cerr << "Cannot write the solutions: " << strerror(result.error) << endl;
+    return 1;
+  }
+  cout << "Solved " << result.solved << "/" << last - first;
+  if (result.timed_out)
+    cout << ", " << result.timed_out << " timed out";
+  if (result.corrupt)
+    cout << ", " << result.corrupt << " corrupt";
+  cout << endl;
+  if (opts.stats)
+    cout << "Latency p50 " << result.p50_micros / 1000 << " ms, p99 "
+         << result.p99_micros / 1000 << " ms" << endl;
+  return result.solved == last - first ? 0 : 1;
+}
 
-// TODO nested while loops, common strategies in the inner one
-bool LogicSolve(Sudoku &board) {
-  bool change = true;
-  bool success = AC3(board);
-  unsigned int max_perm_size = board.blocksize();
-  while (change) {
-    if (!success)
-      return false;
-    bool res1 = HiddenAndSwordfish(board, max_perm_size);
-    if (res1)
-      success &= AC3(board);
-    bool res2 = FindMostNakedPerms(board, max_perm_size);
-    if (res2)
-      success &= AC3(board);
-      success &= AC3(board);
-    change = res1 || res2;
+int ShardCorpus(const options &opts) {
+  size_t first, last;
+  {
+    Corpus puzzles;
+    if (!OpenRange(puzzles, opts, &first, &last))
+      return 1;
   }
-  return true;
+  shardoptions shards;
+  shards.workers = opts.shards;
+  shards.shard_size = opts.shard_size;
+  shards.pin = opts.pin;
+  shards.batch = Batch(opts);
+  if (!opts.threads_set)
+    shards.batch.threads = max(1u, opts.threads / opts.shards);
+  // The workers are forked with a copy of anything still buffered.
+  cout.flush();
+  shardresult result = SolveSharded(opts.paths[0], first, last, shards);
+  if (!result.error.empty()) {
+    cout << "Cannot shard the corpus: " << result.error << endl;
+    return 1;
+  }
+  cout << "Solved " << result.solved << "/" << result.puzzles;
+  if (result.failed)
+    cout << ", " << result.failed << " failed";
+  if (result.timed_out)
+    cout << ", " << result.timed_out << " timed out";
+  if (result.unfinished)
+    cout << ", " << result.unfinished << " unfinished";
+  cout << endl;
+  cout << result.puzzles / max(result.seconds, 1e-3) << " puzzles/s, "
+       << result.seconds << "s on " << opts.shards << " processes";
+  if (result.backups)
+    cout << ", " << result.backups << " straggling shards run twice";
+  if (result.reassigned)
+    cout << ", " << result.reassigned << " shards of dead processes rerun";
+  cout << endl;
+  return result.solved == result.puzzles ? 0 : 1;
 }
 
-bool GuessSolve(Sudoku &board) {
-  bool success = LogicSolve(board);
-  if (!success || board.Solved())
-    return success;
-  // TODO smarter guess?
-  cell guess = board.OrderedCells().front();
-  for (symset::const_iterator it = board[guess].begin();
-       it != board[guess].end(); ++it) {
-    Sudoku board2 = board.Clone();
-    symset &dom = board2[guess];
-    dom.clear();
-    dom.insert(*it);
-    if (GuessSolve(board2)) {
-      board = board2;
-      return true;
-    }
-  } 
-  return false;
+// Writes a cell as its row and column from 1, as in "r3c4".
+string CellName(const cell &c) {
+  ostringstream name;
+  name << 'r' << c.i + 1 << 'c' << c.j + 1;
+  return name.str();
 }
 
-void print_usage() {
-  cout << "Sudoku Solver\n" << endl;
-  cout << "solver [--logic] puzzle\n" << endl;
-  cout << "Solves the Sudoku puzzle, guessing if necessary. If the --logic\n";
-  cout << "flag is provided, the solver will only use logic to try to solve\n";
-  cout << "the puzzle, though it may be unable to completely solve it.";
+int Hint(const options &opts) {
+  Sudoku s = Sudoku::ParseFromFile(opts.paths[0]);
+  Session session (s);
+  const Alphabet &alphabet = s.alphabet();
+  hint h;
+  if (!session.valid()) {
+    cout << "Invalid: the givens contradict each other" << endl;
+    return 1;
+  }
+  if (!session.NextStep(&h)) {
+    cout << "No deduction found" << endl;
+    return 1;
+  }
+  cout << h.name;
+  if (h.size)
+    cout << " (" << h.size << ")";
   cout << endl;
-  exit(0);
+  for (int k = 0; k < h.placements.size(); k++)
+    cout << "Place " << alphabet[h.placements[k].second] << " at "
+         << CellName(h.placements[k].first) << endl;
+  for (int k = 0; k < h.removals.size(); k++) {
+    const removal &r = h.removals[k];
+    cout << "Remove";
+    for (symset::const_iterator it = r.syms.begin(); it != r.syms.end(); ++it)
+      cout << ' ' << alphabet[*it];
+    cout << " from " << CellName(cell(r.x / s.length(), r.x % s.length()))
+         << endl;
+  }
+  return 0;
 }
 
-bool process_args(int argc, char ***argv) {
-  char **args = *argv;
-  bool logic = false;
-  if (argc > 3 || argc < 2)
-    print_usage();
-  for (int i = 1; i < argc; i++) {
-    if (strncmp(args[i], "--logic", 7) == 0)
-      logic = true;
-    else
-      *argv = args + i;
+int SolveOne(const options &opts) {
+  cout << opts.paths[0] << endl;
+  Sudoku s = Sudoku::ParseFromFile(opts.paths[0]);
+  cout << s.ToString() << endl;
+  if (opts.portfolio) {
+    vector<config> configs = DefaultPortfolio();
+    portfolioresult result = SolvePortfolio(s, configs, opts.lim,
+                                            opts.scheduler, opts.tracer);
+    cout << s.ToString() << endl;
+    cout << Outcome(s, result.status) << endl;
+    if (result.winner >= 0)
+      cout << "Won by " << configs[result.winner].name << endl;
+    return 0;
   }
-  if (logic + argc == 3)
-    print_usage();
-  return logic;
+  solvestatus status;
+  if (!opts.checkpoint)
+    status = Solve(s, opts);
+  else if (!SolveCheckpointed(s, opts, &status)) {
+    cout << "Cannot resume from " << opts.checkpoint << endl;
+    return 1;
+  }
+  cout << s.ToString() << endl;
+  cout << Outcome(s, status) << endl;
+  return 0;
+}
+
+// Whether 'path' can be written, tried by opening it to append, which
+// creates it if missing.
+bool CanWrite(const string &path) {
+  ofstream out (path.c_str(), ofstream::out | ofstream::app);
+  return out.good();
 }
 
 int main(int argc, char **argv) {
-  bool logic = process_args(argc, &argv);
-  cout << argv[0] << endl;
-  Sudoku s = Sudoku::ParseFromFile(argv[0]);
-  cout << s.ToString() << endl;
-  if (logic)
-    LogicSolve(s);
-  else
-    GuessSolve(s);
-  cout << s.ToString() << endl;
-  cout << (s.Solved() ? "Solved!" : "Unsolved") << endl;
+  options opts = process_args(argc, argv);
+  signal(SIGINT, interrupt);
+  if (opts.pack)
+    return Pack(opts);
+  if (opts.hint)
+    return Hint(opts);
+  if (opts.verify)
+    return opts.corpus ? VerifyCorpus(opts) : Verify(opts);
+  Scheduler scheduler (opts.adaptive);
+  if (opts.adaptive || opts.stats || opts.profile)
+    opts.scheduler = &scheduler;
+  if (opts.profile)
+    scheduler.Load(opts.profile);
+  if (opts.trace && !CanWrite(opts.trace)) {
+    cout << "Cannot write " << opts.trace << endl;
+    return 1;
+  }
+  if (opts.checkpoint && !Checkpointer::Writable(opts.checkpoint)) {
+    cout << "Cannot write " << opts.checkpoint << endl;
+    return 1;
+  }
+  if (opts.trace)
+    opts.tracer = new Tracer(opts.trace);
+  int result = opts.shards ? ShardCorpus(opts) :
+    opts.corpus ? SolveCorpus(opts) : SolveOne(opts);
+  if (opts.tracer) {
+    unsigned long dropped = opts.tracer->dropped();
+    // Waits for the writer to finish the file.
+    int error = opts.tracer->Close();
+    delete opts.tracer;
+    if (error) {
+      cerr << "Cannot write " << opts.trace << ": " << strerror(error)
+           << endl;
+      result = 1;
+    } else if (dropped) {
+      cerr << "Trace dropped " << dropped << " events" << endl;
+    }
+  }
+  if (opts.profile)
+    scheduler.Save(opts.profile);
+  if (opts.stats)
+    scheduler.Print(cout);
+  return result;
 }
@@ -31,115 +31,205 @@ size_t hash_value(const cell &c) {
 const string Sudoku::symbols =
   "1234567890ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz@$";
 
-Sudoku::Sudoku(unsigned int length)
-  : length_(length), blocksize_(static_cast<unsigned int>(sqrt(length))) {
-  assert(blocksize_ * blocksize_ == length_);
-  board_ = new symset*[length];
-  for (int i = 0; i < length; i++)
-    board_[i] = new symset[length];
-  InitializeConflicting();
+Sudoku::Sudoku(const Topology *topology, const Alphabet *alphabet)
+  : length_(topology->length()), blocksize_(topology->blocksize()),
+    topology_(topology), alphabet_(alphabet), trail_(NULL) {
+  assert(alphabet->size() == length_);
+  Allocate();
+  symset all = symset::All(length_);
+  for (int x = 0; x < length_ * length_; x++)
+    Store(cell(x / length_, x % length_), all);
+  Index();
 }
 
-Sudoku::Sudoku(string *board, unsigned int length)
-  : length_(length), blocksize_(static_cast<unsigned int>(sqrt(length))) {
+Sudoku::Sudoku(const tokengrid &board, const Topology *topology)
+  : length_(board.size()),
+    blocksize_(static_cast<unsigned int>(sqrt(board.size()))),
+    topology_(topology ? topology : Topology::Standard(board.size())),
+    trail_(NULL) {
   assert(blocksize_ * blocksize_ == length_);
+  assert(topology_->length() == length_);
+  assert(length_ <= symset::capacity);
   // Compute alphabet, adding symbols if necessary.
-  symset alphabet;
-  for (int i = 0; i < length; i++)
-    for (int j = 0; j < length; j++)
-      if (board[i][j] != unknown)
-        alphabet.insert(board[i][j]);
-  assert(alphabet.size() <= length);
-#ifdef VERBOSE
-  vector<string> added;
-#endif
-  for (int i = 0; i < symbols.size(); i++) {
-    if (alphabet.size() == length)
-      break;
-    const pair<symset::iterator, bool> &res = alphabet.insert(symbols[i]);
-    if (res.second) {
-#ifdef VERBOSE
-      string sym = "" + symbols[i];
-      added.push_back(sym);
-#endif
+  vector<string> given;
+  for (int i = 0; i < length_; i++)
+    for (int j = 0; j < length_; j++)
+      if (board[i][j] != string(1, unknown))
+        given.push_back(board[i][j]);
+  alphabet_ = Alphabet::Get(length_, given);
+  // Construct board
+  Allocate();
+  symset all = symset::All(length_);
+  for (int i = 0; i < length_; i++) {
+    for (int j = 0; j < length_; j++) {
+      int sym = alphabet_->Find(board[i][j]);
+      symset given;
+      if (sym >= 0)
+        given.insert(sym);
+      Store(cell(i, j), sym < 0 ? all : given);
     }
   }
-  assert(alphabet.size() == length);
-#ifdef VERBOSE
-  cout << "Added " << boost::algorithm::join(added, ", ")
-       << " to alphabet" << endl;
-#endif
-  // Construct board
-  board_ = new symset*[length];
-    for (int i = 0; i < length; i++)
-      board_[i] = new symset[length];
-  for (int i = 0; i < length; i++) {
-    for (int j = 0; j < length; j++) {
-      if (board[i][j] == unknown)
-        board_[i][j] = alphabet;
-      else
-        board_[i][j].insert(board[i][j]);
+  Index();
+}
+
+void Sudoku::Allocate() {
+  words_ = (length_ + 63) / 64;
+  board_.reset(new uint64_t[length_ * length_ * words_]());
+  places_.reset(new uint64_t[topology_->size() * length_ * words_]());
+}
+
+// The bit of position 'p' in its word of a places() entry.
+static uint64_t PlaceBit(unsigned int p) {
+  return static_cast<uint64_t>(1) << (p & 63);
+}
+
+void Sudoku::Index() {
+  for (unsigned int u = 0; u < topology_->size(); u++) {
+    const vector<cell> &unit = topology_->unit(u);
+    for (int p = 0; p < unit.size(); p++) {
+      symset dom = domain(unit[p]);
+      for (symset::const_iterator it = dom.begin(); it != dom.end(); ++it)
+        PlaceWord(u * length_ + *it, p) |= PlaceBit(p);
     }
   }
-  InitializeConflicting();
 }
 
-Sudoku Sudoku::ParseFromFile(const string &path) {
-  ifstream puzzle (path.c_str(), ifstream::in);
+void Sudoku::Forget(const cell &c, const symset &syms) {
+  if (trail_ && !syms.empty()) {
+    removal r;
+    r.x = topology_->index(c);
+    r.syms = syms;
+    trail_->push_back(r);
+  }
+  const vector<unsigned int> &units = topology_->units(c);
+  const vector<unsigned int> &positions = topology_->positions(c);
+  for (symset::const_iterator it = syms.begin(); it != syms.end(); ++it)
+    for (int k = 0; k < units.size(); k++)
+      PlaceWord(units[k] * length_ + *it, positions[k]) &=
+        ~PlaceBit(positions[k]);
+}
+
+void Sudoku::Allow(const cell &c, const symset &syms) {
+  const vector<unsigned int> &units = topology_->units(c);
+  const vector<unsigned int> &positions = topology_->positions(c);
+  for (symset::const_iterator it = syms.begin(); it != syms.end(); ++it)
+    for (int k = 0; k < units.size(); k++)
+      PlaceWord(units[k] * length_ + *it, positions[k]) |=
+        PlaceBit(positions[k]);
+}
+
+unsigned int Sudoku::Subtract(const cell &c, const symset &syms) {
+  symset removed = domain(c);
+  removed.intersect(syms);
+  if (removed.empty())
+    return 0;
+  symset dom = domain(c);
+  dom.subtract(syms);
+  Store(c, dom);
+  Forget(c, removed);
+  return removed.size();
+}
+
+unsigned int Sudoku::Restrict(const cell &c, const symset &keep) {
+  symset removed = domain(c);
+  removed.subtract(keep);
+  if (removed.empty())
+    return 0;
+  symset dom = domain(c);
+  dom.intersect(keep);
+  Store(c, dom);
+  Forget(c, removed);
+  return removed.size();
+}
+
+void Sudoku::Set(const cell &c, const symset &dom) {
+  symset removed = domain(c);
+  symset added = dom;
+  removed.subtract(dom);
+  added.subtract(domain(c));
+  assert(trail_ == NULL || added.empty());
+  Store(c, dom);
+  Forget(c, removed);
+  Allow(c, added);
+}
+
+void Sudoku::Undo(size_t mark) {
+  assert(trail_ && mark <= trail_->size());
+  while (trail_->size() > mark) {
+    const removal &r = trail_->back();
+    cell c (r.x / length_, r.x % length_);
+    symset dom = domain(c);
+    dom |= r.syms;
+    Store(c, dom);
+    Allow(c, r.syms);
+    trail_->pop_back();
+  }
+}
+
+void Sudoku::CopyFrom(const Sudoku &other) {
+  assert(other.topology_ == topology_);
+  unsigned int domains = length_ * length_ * words_;
+  copy(&other.board_[0], &other.board_[0] + domains, &board_[0]);
+  unsigned int places = topology_->size() * length_ * words_;
+  copy(&other.places_[0], &other.places_[0] + places, &places_[0]);
+  alphabet_ = other.alphabet_;
+}
+
+// Splits a row into tokens: whitespace separated if it has any
+// whitespace, otherwise one character per cell.
+static vector<string> Tokenize(const string &line) {
+  vector<string> row;
+  if (line.find_first_of(" \t") == string::npos) {
+    for (int j = 0; j < line.size(); j++)
+      row.push_back(string(1, line[j]));
+  }
+  else {
+    stringstream tokens (line);
+    string tok;
+    while (tokens >> tok)
+      row.push_back(tok);
+  }
+  return row;
+}
+
+tokengrid Sudoku::ReadRows(istream &puzzle) {
   assert(puzzle.good());
   string line;
   getline(puzzle, line);
   boost::algorithm::trim(line);
-  int length = line.size();
-  string *board = new string[length];
-  board[0] = line;
+  tokengrid board;
+  board.push_back(Tokenize(line));
+  int length = board[0].size();
   for (int i = 1; i < length; i++) {
     string nextline;
     assert(puzzle.good());
     getline(puzzle, nextline);
     boost::algorithm::trim(nextline);
-    assert(nextline.size() == length);
-    board[i] = nextline;
+    board.push_back(Tokenize(nextline));
+    assert(board.back().size() == length);
   }
-  Sudoku s (board, length);
-  delete[] board;
-  return s;
+  return board;
 }
 
-void Sudoku::InitializeConflicting() {
-  for (int i = 0; i < length_; i++) {
-    for (int j = 0; j < length_; j++) {
-      vector<cell> con;
-      for (int i2 = 0; i2 < length_; i2++) {
-        if (i2 != i)
-          con.push_back(cell(i2, j));
-      }
-      for (int j2 = 0; j2 < length_; j2++) {
-        if (j2 != j)
-          con.push_back(cell(i, j2));
-      }
-      cell c = corner(i, j);
-      ITERBLOCK(i2, j2, *this, c) {
-        if (i2 != i || j2 != j)
-          con.push_back(cell(i2, j2));
-      }
-      conflicting_[cell(i, j)] = con;
-    }
-  }
+Sudoku Sudoku::ParseFromFile(const string &path) {
+  ifstream puzzle (path.c_str(), ifstream::in);
+  tokengrid board = ReadRows(puzzle);
+  const Topology *topology = Topology::Parse(board.size(), puzzle);
+  return Sudoku(board, topology);
 }
 
 bool Sudoku::Solved() const {
-  for (int i = 0; i < length_; i++) {
-    for (int j = 0; j < length_; j++) {
-      const symset &dom = board_[i][j];
-      if (dom.size() != 1)
+  // Every cell of a solved board is single, so a unit is complete exactly
+  // when none of its cells repeats a symbol already seen in it.
+  for (unsigned int u = 0; u < topology_->size(); u++) {
+    const vector<cell> &unit = topology_->unit(u);
+    symset seen;
+    for (vector<cell>::const_iterator it = unit.begin();
+         it != unit.end(); ++it) {
+      const symset &dom = domain(*it);
+      if (!dom.single() || dom.subsetof(seen))
         return false;
-      const vector<cell> &con = conflicting_.find(cell(i, j))->second;
-      for (vector<cell>::const_iterator it = con.begin();
-           it != con.end(); ++it) {
-        if (dom == board_[it->i][it->j])
-          return false;
-      }
+      seen |= dom;
     }
   }
   return true;
@@ -159,7 +249,7 @@ vector<cell> Sudoku::OrderedCells() const {
   vector<cell> cells;
   for (int i = 0; i < length_; i++)
     for (int j = 0; j < length_; j++)
-      if (board_[i][j].size() > 1)
+      if (domain(i, j).size() > 1)
         cells.push_back(cell(i, j));
   smaller_cell comp (*this);
   sort(cells.begin(), cells.end(), comp);
@@ -167,20 +257,13 @@ vector<cell> Sudoku::OrderedCells() const {
 }
 
 Sudoku Sudoku::Clone() const {
-  Sudoku sudoku (length_);
-  for (int i = 0; i < length_; i++)
-    for (int j = 0; j < length_; j++)
-      sudoku.board_[i][j] = board_[i][j];
+  Sudoku sudoku (*this);
+  sudoku.trail_ = NULL;
+  sudoku.Allocate();
+  sudoku.CopyFrom(*this);
   return sudoku;
 }
 
-string to_char(const symset &dom) {
-  char s = Sudoku::unknown;
-  if (dom.size() == 1)
-    s = static_cast<char>(*dom.begin());
-  return string(1, s);
-}
-
 string ncopies(const string &str, int n) {
   stringstream s;
   for (int i = 0; i < n; i++)
@@ -189,32 +272,46 @@ string ncopies(const string &str, int n) {
 }
 
 string Sudoku::ToString() const {
+  string str;
+  AppendTo(str);
+  return str;
+}
+
+void Sudoku::AppendTo(string &out) const {
   unsigned int n = blocksize_;
-  string dashes = string(2 * n, '-');
+  unsigned int width = alphabet_->width();
+  string dashes = string((width + 1) * n, '-');
   string delim = " " + dashes + "+" + ncopies(dashes + "-+", n - 2) +
     dashes + "\n";
-  stringstream str;
-  str << "\n";
+  out += '\n';
   for (int i = 0; i < length_; i++) {
     if (i % n == 0 && i > 0)
-      str << delim;
+      out += delim;
     for (int j = 0; j < length_; j++) {
       if (j % n == 0 && j > 0)
-        str << " |";
-      str << " " + to_char(board_[i][j]);
+        out += " |";
+      const symset &dom = domain(i, j);
+      if (dom.single()) {
+        const string &tok = (*alphabet_)[dom.front()];
+        out.append(width + 1 - tok.size(), ' ');
+        out += tok;
+      }
+      else {
+        out.append(width, ' ');
+        out += unknown;
+      }
     }
-    str << "\n";
+    out += '\n';
   }
-  return str.str();
 }
 
 void Sudoku::PrintPossibilities() const {
   for (int i = 0; i < length_; i++) {
     for (int j = 0; j < length_; j++) {
       cout << cell(i, j) << ": {";
-      const symset &dom = board_[i][j];
+      const symset &dom = domain(i, j);
       for (symset::const_iterator it = dom.begin(); it != dom.end(); ++it)
-        cout << static_cast<char>(*it) << ',';
+        cout << (*alphabet_)[*it] << ',';
       cout << '}' << endl;
     }
   }
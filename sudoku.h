@@ -1,76 +1,122 @@
 #ifndef __SUDOKU_HEADER__
 #define __SUDOKU_HEADER__
 
-#include <cmath>
+#include <istream>
 #include <ostream>
 #include <string>
+#include <vector>
+#include <stdint.h>
 #include <boost/functional/hash.hpp>
-#include <boost/unordered_map.hpp>
+#include <boost/shared_array.hpp>
 #include <boost/unordered_set.hpp>
 
-class cell {
-public:
-  unsigned int i;
-  unsigned int j;
-  
-  cell() { }
-  cell(unsigned int i, unsigned int j) : i(i), j(j) { }
-  
-  bool operator==(const cell &other) const {
-    return i == other.i && j == other.j;
-  }
-
-  bool operator!=(const cell &other) const {
-    return i != other.i || j != other.j;
-  }
-};
+#include "alphabet.h"
+#include "cell.h"
+#include "symset.h"
+#include "topology.h"
 
-std::ostream &operator<<(std::ostream &out, const cell &c);
-
-std::size_t hash_value(const cell &c);
-
-typedef boost::unordered_set<int> symset;
-typedef boost::unordered_map<cell, std::vector<cell> > cellmap;
 typedef boost::unordered_set<cell> cellset;
 
-#define ITERBLOCK(INAME, JNAME, BOARD, C)                               \
-  for (int INAME = C.i; INAME < C.i + (BOARD).blocksize(); INAME++)     \
-    for (int JNAME = C.j; JNAME < C.j + (BOARD).blocksize(); JNAME++)   \
+// Symbols removed from the cell at Topology::index() 'x'.
+struct removal {
+  unsigned int x;
+  symset syms;
+};
+// The removals made to a board, in order, so they can be undone.
+typedef std::vector<removal> trail;
+// A puzzle as read from a file: one token per cell, row by row.
+typedef std::vector<std::vector<std::string> > tokengrid;
 
+// Copies of a Sudoku share their cells; use Clone() for an independent
+// board.
 class Sudoku {
 private:
-  symset **board_;
+  // The domains, 'words_' words each.
+  boost::shared_array<uint64_t> board_;
+  // The transpose of the board: for each unit and symbol, the positions
+  // in the unit whose cells can still hold the symbol, 'words_' words
+  // each.
+  boost::shared_array<uint64_t> places_;
+  // Words per domain and per entry of places(): ceil(length / 64).
+  unsigned int words_;
   unsigned int length_;
   unsigned int blocksize_;
-  cellmap conflicting_;
+  const Topology *topology_;
+  const Alphabet *alphabet_;
+  trail *trail_;
 
 public:
   static const char unknown = '*';
   static const std::string symbols;
 
-  Sudoku(unsigned int length);
-  Sudoku(std::string *board, unsigned int length);
+  // A board with every symbol possible in every cell.
+  Sudoku(const Topology *topology, const Alphabet *alphabet);
+  // Uses the standard topology if 'topology' is NULL.
+  Sudoku(const tokengrid &board, const Topology *topology = NULL);
 
-  // Parses the Sudoku puzzle from a file, assuming no spaces are present
-  // and using the above symbol for unknown.
+  // Parses the Sudoku puzzle from a file, using the above symbol for
+  // unknown. Rows are either one character per cell with no spaces, or
+  // whitespace separated tokens, which boards larger than 64x64 need.
+  // The rows may be followed by variant lines, see Topology::Parse().
   static Sudoku ParseFromFile(const std::string &path);
+  // Reads the rows of a puzzle without building a board, leaving the
+  // stream at the variant lines.
+  static tokengrid ReadRows(std::istream &puzzle);
 
   // The side length of the puzzle.
   unsigned int length() const { return length_; }
   // The sidelength of a block.
   unsigned int blocksize() const { return blocksize_; }
 
-  // Gets the remaining possibilities for this cell.
-  symset &domain(int i, int j) { return board_[i][j]; }
-  const symset &domain(int i, int j) const { return board_[i][j]; }
-  symset &domain(const cell &c) { return board_[c.i][c.j]; }
-  const symset &domain(const cell &c) const { return board_[c.i][c.j]; }
+  // The symbols of the puzzle. Domains hold indices into it.
+  const Alphabet &alphabet() const { return *alphabet_; }
+
+  // The words each domain takes.
+  unsigned int words() const { return words_; }
+
+  // Gets the remaining possibilities for this cell. Domains are copied
+  // out of the board, so they do not follow later changes to it.
+  symset domain(int i, int j) const {
+    return symset(&board_[(i * length_ + j) * words_], words_);
+  }
+  symset domain(const cell &c) const { return domain(c.i, c.j); }
+
+  // A row of the board, for board[i][j].
+  class row {
+  private:
+    const Sudoku *board_;
+    unsigned int i_;
+  public:
+    row(const Sudoku *board, unsigned int i) : board_(board), i_(i) { }
+    symset operator[](unsigned int j) const { return board_->domain(i_, j); }
+  };
 
   // Syntactic sugar for the domain accessor.
-  symset *operator[](unsigned int i) { return board_[i]; }
-  const symset *operator[](unsigned int i) const { return board_[i]; }
-  symset &operator[](const cell &c) { return board_[c.i][c.j]; }
-  const symset &operator[](const cell &c) const { return board_[c.i][c.j]; }
+  row operator[](unsigned int i) const { return row(this, i); }
+  symset operator[](const cell &c) const { return domain(c.i, c.j); }
+
+  // The positions in unit 'u', as indices into Topology::unit(u), whose
+  // cells can still hold 'sym'.
+  symset places(unsigned int u, int sym) const {
+    return symset(&places_[(u * length_ + sym) * words_], words_);
+  }
+
+  // Domains only change through these, which keep places() in step at a
+  // few word operations per symbol removed from each unit of the cell.
+  // Each returns the number of symbols removed.
+  unsigned int Subtract(const cell &c, const symset &syms);
+  unsigned int Restrict(const cell &c, const symset &keep);
+  // Replaces a domain, which may add symbols as well as remove them.
+  void Set(const cell &c, const symset &dom);
+  // Overwrites this board with one of the same topology, without
+  // allocating.
+  void CopyFrom(const Sudoku &other);
+
+  // While 'log' is set, every removal is appended to it, and Undo() puts
+  // back those after the first 'mark'. Set() may not add symbols then.
+  // NULL stops recording.
+  void Track(trail *log) { trail_ = log; }
+  void Undo(std::size_t mark);
 
   // Gets the corner of the block containing this cell.
   cell corner(int i, int j) const {
@@ -80,12 +126,15 @@ public:
     return cell(c.i - c.i % blocksize_, c.j - c.j % blocksize_);
   }
 
+  // The units of this puzzle.
+  const Topology &topology() const { return *topology_; }
+
   // Gets the list of cells that cannot share the same value with this cell.
   const std::vector<cell> &conflicting(int i, int j) const {
-    return conflicting_.find(cell(i, j))->second;
+    return topology_->peers(cell(i, j));
   }
   const std::vector<cell> &conflicting(const cell &c) const {
-    return conflicting_.find(c)->second;
+    return topology_->peers(c);
   }
 
   // Sees whether the puzzle is solved.
@@ -97,12 +146,27 @@ public:
   Sudoku Clone() const;
   // A really nice string representation of the board.
   std::string ToString() const;
+  // Appends ToString() to 'out', for writers reusing one buffer.
+  void AppendTo(std::string &out) const;
   // (Debugging only) Prints the possibilities for each cell.
   void PrintPossibilities() const;
 
 private:
-  // Initializes the structure containing conflicting cell information.
-  void InitializeConflicting();
+  // Allocates a board of empty domains, with no places.
+  void Allocate();
+  // Builds places() from the domains.
+  void Index();
+  // Overwrites the domain of 'c', without updating places().
+  void Store(const cell &c, const symset &dom) {
+    dom.store(&board_[(c.i * length_ + c.j) * words_], words_);
+  }
+  // The word of the places() entry 'entry' that holds position 'p'.
+  uint64_t &PlaceWord(unsigned int entry, unsigned int p) {
+    return places_[entry * words_ + (p >> 6)];
+  }
+  // Updates places() for symbols leaving or joining the domain of 'c'.
+  void Forget(const cell &c, const symset &syms);
+  void Allow(const cell &c, const symset &syms);
 };
 
 #endif // __SUDOKU_HEADER__
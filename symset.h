@@ -0,0 +1,273 @@
+#ifndef __SYMSET_HEADER__
+#define __SYMSET_HEADER__
+
+#include <cstddef>
+#include <iterator>
+#include <stdint.h>
+
+// The most 64-bit words a set holds, which bounds the board size. Sets
+// only use the words their symbols need, and boards store each domain in
+// ceil(length / 64) words, so this only sizes the sets kept on the stack:
+// a 9x9 board pays for one word per domain whatever the bound.
+#ifndef SYMSET_WORDS
+#define SYMSET_WORDS 4
+#endif
+
+// A set of symbol indices, stored as a bitset so that boards are flat
+// arrays and whole-set operations are a few word operations. A set uses
+// only the words up to its highest symbol, or as many as the board it
+// came from stores, and operations touch no others. The first word is
+// kept apart from the rest, so that the sets of boards up to 64x64 live
+// in registers. The interface mirrors the unordered_set it replaced.
+class symset {
+private:
+  uint64_t first_;
+  // Words 1 onwards. Those from 'used_' on are empty, whatever they hold.
+  uint64_t rest_[SYMSET_WORDS > 1 ? SYMSET_WORDS - 1 : 1];
+  // At least 1.
+  unsigned int used_;
+
+public:
+  static const unsigned int capacity = 64 * SYMSET_WORDS;
+
+  class const_iterator
+    : public std::iterator<std::forward_iterator_tag, int, std::ptrdiff_t,
+                           const int *, int> {
+  private:
+    const symset *set_;
+    int sym_;
+  public:
+    const_iterator() : set_(NULL), sym_(capacity) { }
+    const_iterator(const symset *set, int sym) : set_(set), sym_(sym) { }
+    int operator*() const { return sym_; }
+    const_iterator &operator++() {
+      sym_ = set_->next(sym_ + 1);
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator old = *this;
+      ++*this;
+      return old;
+    }
+    bool operator==(const const_iterator &other) const {
+      return sym_ == other.sym_;
+    }
+    bool operator!=(const const_iterator &other) const {
+      return sym_ != other.sym_;
+    }
+  };
+  typedef const_iterator iterator;
+
+  symset() : first_(0), used_(1) { }
+  // The set stored in the 'n' words at 'words', symbol 0 in the lowest
+  // bit of the first.
+  symset(const uint64_t *words, unsigned int n) : first_(words[0]), used_(n) {
+    for (unsigned int w = 1; w < n; w++)
+      rest_[w - 1] = words[w];
+  }
+  symset(const symset &other) : first_(other.first_), used_(other.used_) {
+    for (unsigned int w = 1; w < used_; w++)
+      rest_[w - 1] = other.rest_[w - 1];
+  }
+  symset &operator=(const symset &other) {
+    first_ = other.first_;
+    used_ = other.used_;
+    for (unsigned int w = 1; w < used_; w++)
+      rest_[w - 1] = other.rest_[w - 1];
+    return *this;
+  }
+
+  // Every symbol below 'n'.
+  static symset All(unsigned int n) {
+    symset s;
+    for (unsigned int w = 0; n > 0; w++, n = n >= 64 ? n - 64 : 0)
+      s.set_word(w, n >= 64 ? ~static_cast<uint64_t>(0)
+                            : (static_cast<uint64_t>(1) << n) - 1);
+    return s;
+  }
+
+  // Writes the set to the 'n' words at 'words', which must have room
+  // for its symbols.
+  void store(uint64_t *words, unsigned int n) const {
+    words[0] = first_;
+    for (unsigned int w = 1; w < n; w++)
+      words[w] = w < used_ ? rest_[w - 1] : 0;
+  }
+
+  std::size_t size() const {
+    std::size_t n = __builtin_popcountll(first_);
+    for (unsigned int w = 1; w < used_; w++)
+      n += __builtin_popcountll(rest_[w - 1]);
+    return n;
+  }
+  // Equivalent to size() == 1, without counting.
+  bool single() const {
+    unsigned int nonzero = first_ != 0;
+    uint64_t multiple = first_ & (first_ - 1);
+    for (unsigned int w = 1; w < used_; w++) {
+      nonzero += rest_[w - 1] != 0;
+      multiple |= rest_[w - 1] & (rest_[w - 1] - 1);
+    }
+    return nonzero == 1 && multiple == 0;
+  }
+  bool empty() const {
+    uint64_t any = first_;
+    for (unsigned int w = 1; w < used_; w++)
+      any |= rest_[w - 1];
+    return any == 0;
+  }
+  void clear() {
+    first_ = 0;
+    used_ = 1;
+  }
+
+  bool count(int sym) const { return (word(sym >> 6) >> (sym & 63)) & 1; }
+  const_iterator find(int sym) const {
+    return count(sym) ? const_iterator(this, sym) : end();
+  }
+  // Returns whether the symbol was added.
+  bool insert(int sym) {
+    uint64_t bit = static_cast<uint64_t>(1) << (sym & 63);
+    uint64_t old = word(sym >> 6);
+    set_word(sym >> 6, old | bit);
+    return !(old & bit);
+  }
+  template <typename InputIterator>
+  void insert(InputIterator first, InputIterator last) {
+    for (; first != last; ++first)
+      insert(*first);
+  }
+  std::size_t erase(int sym) {
+    uint64_t bit = static_cast<uint64_t>(1) << (sym & 63);
+    uint64_t old = word(sym >> 6);
+    if (!(old & bit))
+      return 0;
+    set_word(sym >> 6, old & ~bit);
+    return 1;
+  }
+  const_iterator erase(const_iterator it) {
+    const_iterator next = it;
+    ++next;
+    erase(*it);
+    return next;
+  }
+
+  const_iterator begin() const { return const_iterator(this, next(0)); }
+  const_iterator end() const { return const_iterator(this, capacity); }
+  // The smallest symbol in a non-empty set.
+  int front() const { return next(0); }
+
+  // Whole-set operations. Those returning bool report whether this set
+  // changed.
+  symset &operator|=(const symset &other) {
+    first_ |= other.first_;
+    if (Spans(other.used_))
+      UniteRest(other);
+    return *this;
+  }
+  bool intersect(const symset &other) {
+    uint64_t changed = first_ & ~other.first_;
+    first_ &= other.first_;
+    if (Spans(used_))
+      changed |= IntersectRest(other);
+    return changed != 0;
+  }
+  bool subtract(const symset &other) {
+    uint64_t changed = first_ & other.first_;
+    first_ &= ~other.first_;
+    if (Spans(used_) && Spans(other.used_))
+      changed |= SubtractRest(other);
+    return changed != 0;
+  }
+  bool subsetof(const symset &other) const {
+    uint64_t extra = first_ & ~other.first_;
+    if (Spans(used_))
+      extra |= ExtraRest(other);
+    return extra == 0;
+  }
+  bool operator==(const symset &other) const {
+    if (first_ != other.first_)
+      return false;
+    return (!Spans(used_) && !Spans(other.used_)) ||
+      (ExtraRest(other) == 0 && other.ExtraRest(*this) == 0);
+  }
+  bool operator!=(const symset &other) const { return !(*this == other); }
+
+  // Raw access for packing domains.
+  uint64_t word(unsigned int w) const {
+    return w == 0 ? first_ : w < used_ ? rest_[w - 1] : 0;
+  }
+  void set_word(unsigned int w, uint64_t bits) {
+    if (w == 0) {
+      first_ = bits;
+      return;
+    }
+    for (; used_ <= w; used_++)
+      rest_[used_ - 1] = 0;
+    rest_[w - 1] = bits;
+  }
+
+private:
+  // Whether 'used' words go past the first, which they never do when
+  // sets hold one.
+  static bool Spans(unsigned int used) {
+    return SYMSET_WORDS > 1 && used > 1;
+  }
+  // Words both sets use.
+  unsigned int Shared(const symset &other) const {
+    return used_ < other.used_ ? used_ : other.used_;
+  }
+  // The whole-set operations on the words after the first, each
+  // returning the bits changed or, for ExtraRest(), those of this set
+  // missing from 'other'.
+  void UniteRest(const symset &other) {
+    unsigned int shared = Shared(other);
+    for (unsigned int w = 1; w < shared; w++)
+      rest_[w - 1] |= other.rest_[w - 1];
+    for (; used_ < other.used_; used_++)
+      rest_[used_ - 1] = other.rest_[used_ - 1];
+  }
+  uint64_t IntersectRest(const symset &other) {
+    unsigned int shared = Shared(other);
+    uint64_t changed = 0;
+    for (unsigned int w = 1; w < shared; w++) {
+      changed |= rest_[w - 1] & ~other.rest_[w - 1];
+      rest_[w - 1] &= other.rest_[w - 1];
+    }
+    for (unsigned int w = shared; w < used_; w++)
+      changed |= rest_[w - 1];
+    used_ = shared;
+    return changed;
+  }
+  uint64_t SubtractRest(const symset &other) {
+    unsigned int shared = Shared(other);
+    uint64_t changed = 0;
+    for (unsigned int w = 1; w < shared; w++) {
+      changed |= rest_[w - 1] & other.rest_[w - 1];
+      rest_[w - 1] &= ~other.rest_[w - 1];
+    }
+    return changed;
+  }
+  uint64_t ExtraRest(const symset &other) const {
+    unsigned int shared = Shared(other);
+    uint64_t extra = 0;
+    for (unsigned int w = 1; w < shared; w++)
+      extra |= rest_[w - 1] & ~other.rest_[w - 1];
+    for (unsigned int w = shared; w < used_; w++)
+      extra |= rest_[w - 1];
+    return extra;
+  }
+  // The first symbol at or after 'sym', or capacity.
+  int next(int sym) const {
+    for (unsigned int w = sym >> 6; w < used_; w++) {
+      uint64_t bits = word(w);
+      if (w == sym >> 6)
+        bits &= ~static_cast<uint64_t>(0) << (sym & 63);
+      if (bits)
+        return (w << 6) + __builtin_ctzll(bits);
+    }
+    return capacity;
+  }
+};
+
+#endif // __SYMSET_HEADER__
@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+#include "solve.h"
+#include "sudoku.h"
+
+using namespace std;
+
+// Words in a cell mask, which bounds templates to boards of up to 16x16.
+static const unsigned int MASK_WORDS = 4;
+// Boards of up to this many cells, 9x9 and smaller, have every template
+// listed once per topology: a standard 9x9 board has 46,656 per symbol.
+// Larger boards search for templates through the candidates left.
+static const unsigned int TABLE_CELLS = 81;
+// Nodes the search for a template through one candidate may visit before
+// giving up and keeping the candidate.
+static const unsigned long MAX_TEMPLATE_NODES = 1 << 12;
+
+// A set of cells, by Topology::index().
+struct cellmask {
+  uint64_t w[MASK_WORDS];
+
+  cellmask() {
+    for (int k = 0; k < MASK_WORDS; k++)
+      w[k] = 0;
+  }
+  void set(unsigned int x) {
+    w[x >> 6] |= static_cast<uint64_t>(1) << (x & 63);
+  }
+  void reset(unsigned int x) {
+    w[x >> 6] &= ~(static_cast<uint64_t>(1) << (x & 63));
+  }
+  bool test(unsigned int x) const { return w[x >> 6] >> (x & 63) & 1; }
+  bool empty() const {
+    uint64_t any = 0;
+    for (int k = 0; k < MASK_WORDS; k++)
+      any |= w[k];
+    return any == 0;
+  }
+  unsigned int size() const {
+    unsigned int n = 0;
+    for (int k = 0; k < MASK_WORDS; k++)
+      n += __builtin_popcountll(w[k]);
+    return n;
+  }
+  // The first cell of a non-empty set.
+  unsigned int front() const {
+    int k = 0;
+    while (w[k] == 0)
+      k++;
+    return (k << 6) + __builtin_ctzll(w[k]);
+  }
+  bool meets(const cellmask &other) const {
+    uint64_t common = 0;
+    for (int k = 0; k < MASK_WORDS; k++)
+      common |= w[k] & other.w[k];
+    return common != 0;
+  }
+  cellmask within(const cellmask &other) const {
+    cellmask common;
+    for (int k = 0; k < MASK_WORDS; k++)
+      common.w[k] = w[k] & other.w[k];
+    return common;
+  }
+  cellmask without(const cellmask &other) const {
+    cellmask left;
+    for (int k = 0; k < MASK_WORDS; k++)
+      left.w[k] = w[k] & ~other.w[k];
+    return left;
+  }
+  cellmask &operator|=(const cellmask &other) {
+    for (int k = 0; k < MASK_WORDS; k++)
+      w[k] |= other.w[k];
+    return *this;
+  }
+};
+
+// ---------------------------------------------------------------------------
+// ------------------------------ Templates ----------------------------------
+// ---------------------------------------------------------------------------
+
+// What the template searches need of a topology, as cell masks.
+struct templatetable {
+  unsigned int length;
+  // The peers of each cell, and the cells of each row and each unit.
+  vector<cellmask> peers;
+  vector<cellmask> rows;
+  vector<cellmask> units;
+  // On boards of up to TABLE_CELLS cells, every template, as its first
+  // and second words in two flat arrays so that Overlay() vectorizes.
+  // Templates are grouped by the columns of their cells in the first two
+  // rows: those in columns a and b are at start[a * length + b] up to the
+  // next start. Each group is padded to an even size.
+  vector<uint64_t> low, high;
+  vector<size_t> start;
+};
+
+// Fills rows order[depth..] of 'chosen' with a cell of options[row] each,
+// never two in a unit, and checks every unit is met. Stops at the first
+// template found, or appends every one to 'all' if given. Returns true
+// if it stopped early, having found one or run out of 'nodes'.
+static bool Extend(const templatetable &table,
+                   const vector<cellmask> &options,
+                   const vector<unsigned int> &order, unsigned int depth,
+                   const cellmask &blocked, cellmask &chosen,
+                   unsigned long &nodes, vector<cellmask> *all) {
+  if (depth == order.size()) {
+    // Rows, columns and blocks are met by any template; diagonals and
+    // windows may be missed.
+    for (int u = 0; u < table.units.size(); u++)
+      if (!table.units[u].meets(chosen))
+        return false;
+    if (!all)
+      return true;
+    all->push_back(chosen);
+    return false;
+  }
+  if (nodes == 0)
+    return true;
+  nodes--;
+  for (unsigned int k = depth + 1; k < order.size(); k++)
+    if (options[order[k]].without(blocked).empty())
+      return false;
+  cellmask free = options[order[depth]].without(blocked);
+  while (!free.empty()) {
+    unsigned int x = free.front();
+    free.reset(x);
+    cellmask next = blocked;
+    next |= table.peers[x];
+    chosen.set(x);
+    if (Extend(table, options, order, depth + 1, next, chosen, nodes, all))
+      return true;
+    chosen.reset(x);
+  }
+  return false;
+}
+
+// The rows by increasing number of options, so searches branch late.
+static vector<unsigned int> Order(const vector<cellmask> &options) {
+  vector<pair<unsigned int, unsigned int> > sizes;
+  for (unsigned int r = 0; r < options.size(); r++)
+    sizes.push_back(make_pair(options[r].size(), r));
+  sort(sizes.begin(), sizes.end());
+  vector<unsigned int> order;
+  for (int k = 0; k < sizes.size(); k++)
+    order.push_back(sizes[k].second);
+  return order;
+}
+
+static templatetable *Build(const Topology &topo) {
+  templatetable *table = new templatetable;
+  unsigned int length = topo.length();
+  table->length = length;
+  table->peers.resize(length * length);
+  table->rows.resize(length);
+  for (unsigned int x = 0; x < length * length; x++) {
+    cell c (x / length, x % length);
+    const vector<cell> &peers = topo.peers(c);
+    for (vector<cell>::const_iterator p = peers.begin(); p != peers.end();
+         ++p)
+      table->peers[x].set(topo.index(*p));
+    table->rows[c.i].set(x);
+  }
+  table->units.resize(topo.size());
+  for (unsigned int u = 0; u < topo.size(); u++)
+    for (int k = 0; k < topo.unit(u).size(); k++)
+      table->units[u].set(topo.index(topo.unit(u)[k]));
+  if (length * length > TABLE_CELLS)
+    return table;
+  vector<cellmask> all;
+  cellmask chosen;
+  unsigned long nodes = ~0ul;
+  Extend(*table, table->rows, Order(table->rows), 0, cellmask(), chosen,
+         nodes, &all);
+  vector<vector<cellmask> > groups (length * length);
+  for (int t = 0; t < all.size(); t++) {
+    unsigned int a = all[t].within(table->rows[0]).front() % length;
+    unsigned int b = all[t].within(table->rows[1]).front() % length;
+    groups[a * length + b].push_back(all[t]);
+  }
+  for (int g = 0; g < groups.size(); g++) {
+    table->start.push_back(table->low.size());
+    for (int t = 0; t < groups[g].size(); t++) {
+      table->low.push_back(groups[g][t].w[0]);
+      table->high.push_back(groups[g][t].w[1]);
+    }
+    // Padding that fits nowhere, as it covers cells past the board.
+    if (table->low.size() % 2) {
+      table->low.push_back(~0ul);
+      table->high.push_back(~0ul);
+    }
+  }
+  table->start.push_back(table->low.size());
+  return table;
+}
+
+// The last topology each thread looked up, and its table.
+struct tablecache {
+  const Topology *topo;
+  const templatetable *table;
+};
+static thread_local tablecache last = { NULL, NULL };
+
+// The table of a topology, built on first use and kept, like topologies,
+// for the rest of the process. Threads remember the last they looked up,
+// so the lock is only taken when a thread meets a new topology.
+static const templatetable &Table(const Topology &topo) {
+  if (last.topo == &topo)
+    return *last.table;
+  static mutex lock;
+  static boost::unordered_map<const Topology *, templatetable *> cache;
+  lock_guard<mutex> hold (lock);
+  templatetable *&table = cache[&topo];
+  if (table == NULL)
+    table = Build(topo);
+  last.topo = &topo;
+  last.table = table;
+  return *table;
+}
+
+// The union of the listed templates lying within 'places', from the
+// groups whose first two cells it holds. Each group is filtered without
+// branches, two templates a step, which the compiler turns into vector
+// instructions at -O2.
+static cellmask Overlay(const templatetable &table, const cellmask &places) {
+  unsigned int length = table.length;
+  uint64_t miss_low = ~places.w[0], miss_high = ~places.w[1];
+  uint64_t low[2] = {0, 0}, high[2] = {0, 0};
+  const uint64_t *lows = &table.low[0], *highs = &table.high[0];
+  cellmask first = table.rows[0].within(places);
+  while (!first.empty()) {
+    unsigned int a = first.front();
+    first.reset(a);
+    cellmask second = table.rows[1].within(places);
+    while (!second.empty()) {
+      unsigned int b = second.front();
+      second.reset(b);
+      unsigned int g = a * length + b % length;
+      for (size_t t = table.start[g]; t < table.start[g + 1]; t += 2) {
+        for (int k = 0; k < 2; k++) {
+          uint64_t miss = (lows[t + k] & miss_low) |
+            (highs[t + k] & miss_high);
+          // All ones if nothing is missed: miss | -miss has its top bit
+          // set exactly when miss is not zero.
+          uint64_t keep = ((miss | -miss) >> 63) - 1;
+          low[k] |= lows[t + k] & keep;
+          high[k] |= highs[t + k] & keep;
+        }
+      }
+    }
+  }
+  cellmask cover;
+  cover.w[0] = low[0] | low[1];
+  cover.w[1] = high[0] | high[1];
+  return cover;
+}
+
+// The cells of 'places' lying in some template within it, found by
+// searching for one through each cell no template found so far covers.
+// Cells with none are left out of the rest of the searches, and cells
+// whose search runs out of nodes are kept.
+static cellmask Cover(const templatetable &table, cellmask places) {
+  unsigned int length = table.length;
+  cellmask cover;
+  vector<cellmask> options (length);
+  for (cellmask todo = places; !todo.empty();
+       todo = places.without(cover)) {
+    unsigned int x = todo.front();
+    for (unsigned int r = 0; r < length; r++)
+      options[r] = table.rows[r].within(places);
+    options[x / length] = cellmask();
+    options[x / length].set(x);
+    cellmask chosen;
+    unsigned long nodes = MAX_TEMPLATE_NODES;
+    bool stopped = Extend(table, options, Order(options), 0, cellmask(),
+                          chosen, nodes, NULL);
+    if (stopped && chosen.size() == length)
+      cover |= chosen;
+    else if (stopped)
+      cover.set(x);
+    else
+      places.reset(x);
+  }
+  return cover;
+}
+
+bool Templates(Sudoku &board, bool *error, vector<unsigned long> *by_size) {
+  unsigned int length = board.length();
+  if (length * length > 64 * MASK_WORDS)
+    return false;
+  const templatetable &table = Table(board.topology());
+  unsigned int removed = 0;
+  for (int sym = 0; sym < length; sym++) {
+    cellmask places;
+    for (unsigned int x = 0; x < length * length; x++)
+      if (board[x / length][x % length].count(sym))
+        places.set(x);
+    cellmask cover = table.low.empty() ? Cover(table, places)
+                                       : Overlay(table, places);
+    if (cover.empty()) {
+      *error = true;
+      break;
+    }
+    symset only;
+    only.insert(sym);
+    for (cellmask out = places.without(cover); !out.empty(); ) {
+      unsigned int x = out.front();
+      out.reset(x);
+      removed += board.Subtract(cell(x / length, x % length), only);
+    }
+  }
+  if (by_size)
+    (*by_size)[0] += removed;
+  return removed > 0 || *error;
+}
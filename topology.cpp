@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "topology.h"
+
+using namespace std;
+
+Topology::Topology(unsigned int length, bool diagonal, bool windoku,
+                   const vector<string> &regions)
+  : length_(length), blocksize_(static_cast<unsigned int>(sqrt(length))),
+    diagonal_(diagonal), windoku_(windoku), regions_(regions),
+    cell_units_(length * length), cell_positions_(length * length),
+    peers_(length * length) {
+  assert(blocksize_ * blocksize_ == length_);
+  for (int i = 0; i < length; i++) {
+    vector<cell> row;
+    for (int j = 0; j < length; j++)
+      row.push_back(cell(i, j));
+    AddUnit(ROW, row);
+  }
+  for (int j = 0; j < length; j++) {
+    vector<cell> col;
+    for (int i = 0; i < length; i++)
+      col.push_back(cell(i, j));
+    AddUnit(COL, col);
+  }
+  if (regions.empty()) {
+    for (int bi = 0; bi < length; bi += blocksize_) {
+      for (int bj = 0; bj < length; bj += blocksize_) {
+        vector<cell> blk;
+        for (int i = bi; i < bi + blocksize_; i++)
+          for (int j = bj; j < bj + blocksize_; j++)
+            blk.push_back(cell(i, j));
+        AddUnit(BLK, blk);
+      }
+    }
+  }
+  else {
+    // Regions are numbered in order of first appearance.
+    assert(regions.size() == length);
+    string labels;
+    vector<vector<cell> > blks;
+    for (int i = 0; i < length; i++) {
+      assert(regions[i].size() == length);
+      for (int j = 0; j < length; j++) {
+        size_t r = labels.find(regions[i][j]);
+        if (r == string::npos) {
+          r = labels.size();
+          labels += regions[i][j];
+          blks.push_back(vector<cell>());
+        }
+        blks[r].push_back(cell(i, j));
+      }
+    }
+    assert(blks.size() == length);
+    for (int r = 0; r < blks.size(); r++) {
+      assert(blks[r].size() == length);
+      AddUnit(BLK, blks[r]);
+    }
+  }
+  if (diagonal) {
+    vector<cell> down, up;
+    for (int i = 0; i < length; i++) {
+      down.push_back(cell(i, i));
+      up.push_back(cell(i, length - 1 - i));
+    }
+    AddUnit(DIAG, down);
+    AddUnit(DIAG, up);
+  }
+  if (windoku) {
+    // Windows sit one cell in from each block corner, separated by a
+    // single line of cells.
+    for (int wi = 1; wi + blocksize_ < length; wi += blocksize_ + 1) {
+      for (int wj = 1; wj + blocksize_ < length; wj += blocksize_ + 1) {
+        vector<cell> win;
+        for (int i = wi; i < wi + blocksize_; i++)
+          for (int j = wj; j < wj + blocksize_; j++)
+            win.push_back(cell(i, j));
+        AddUnit(WINDOW, win);
+      }
+    }
+  }
+
+  // Peers, in unit order and without duplicates.
+  vector<unsigned int> seen (length * length, length * length);
+  for (int i = 0; i < length; i++) {
+    for (int j = 0; j < length; j++) {
+      cell c (i, j);
+      unsigned int x = index(c);
+      seen[x] = x;
+      const vector<unsigned int> &us = cell_units_[x];
+      for (vector<unsigned int>::const_iterator u = us.begin();
+           u != us.end(); ++u) {
+        for (vector<cell>::const_iterator it = units_[*u].begin();
+             it != units_[*u].end(); ++it) {
+          if (seen[index(*it)] != x) {
+            seen[index(*it)] = x;
+            peers_[x].push_back(*it);
+          }
+        }
+      }
+    }
+  }
+  FindIntersections();
+}
+
+void Topology::AddUnit(grouptype kind, const vector<cell> &cells) {
+  unsigned int u = units_.size();
+  units_.push_back(cells);
+  kinds_.push_back(kind);
+  for (int p = 0; p < cells.size(); p++) {
+    cell_units_[index(cells[p])].push_back(u);
+    cell_positions_[index(cells[p])].push_back(p);
+  }
+}
+
+void Topology::FindIntersections() {
+  // The shared positions of unit u with each later unit.
+  vector<intersection> with (units_.size());
+  vector<unsigned int> shared (units_.size());
+  for (unsigned int u = 0; u < units_.size(); u++) {
+    fill(shared.begin(), shared.end(), 0);
+    for (unsigned int v = u + 1; v < units_.size(); v++) {
+      with[v].shared[0].clear();
+      with[v].shared[1].clear();
+    }
+    for (int p = 0; p < units_[u].size(); p++) {
+      unsigned int x = index(units_[u][p]);
+      for (int k = 0; k < cell_units_[x].size(); k++) {
+        unsigned int v = cell_units_[x][k];
+        if (v <= u)
+          continue;
+        with[v].shared[0].insert(p);
+        with[v].shared[1].insert(cell_positions_[x][k]);
+        shared[v]++;
+      }
+    }
+    for (unsigned int v = u + 1; v < units_.size(); v++) {
+      if (shared[v] < 2)
+        continue;
+      with[v].units[0] = u;
+      with[v].units[1] = v;
+      intersections_.push_back(with[v]);
+    }
+  }
+}
+
+const Topology *Topology::Standard(unsigned int length) {
+  return Get(length, false, false, vector<string>());
+}
+
+const Topology *Topology::Get(unsigned int length, bool diagonal,
+                              bool windoku, const vector<string> &regions) {
+  // Topologies live for the rest of the process, like static tables.
+  static boost::unordered_map<string, const Topology *> cache;
+  stringstream key;
+  key << length << diagonal << windoku;
+  for (int i = 0; i < regions.size(); i++)
+    key << regions[i];
+  const Topology *&topo = cache[key.str()];
+  if (topo == NULL)
+    topo = new Topology(length, diagonal, windoku, regions);
+  return topo;
+}
+
+const Topology *Topology::Parse(unsigned int length, istream &in) {
+  bool diagonal = false, windoku = false;
+  vector<string> regions;
+  string line;
+  while (getline(in, line)) {
+    boost::algorithm::trim(line);
+    if (line.empty())
+      continue;
+    if (line == "diagonal")
+      diagonal = true;
+    else if (line == "windoku")
+      windoku = true;
+    else if (line == "jigsaw") {
+      for (int i = 0; i < length; i++) {
+        assert(in.good());
+        getline(in, line);
+        boost::algorithm::trim(line);
+        assert(line.size() == length);
+        regions.push_back(line);
+      }
+    }
+    else
+      assert(false && "unknown puzzle variant");
+  }
+  return Get(length, diagonal, windoku, regions);
+}
+
+string Topology::UnitName(unsigned int u) const {
+  stringstream str;
+  const cell &first = units_[u].front();
+  switch (kinds_[u]) {
+  case ROW:
+    str << "row " << first.i;
+    break;
+  case COL:
+    str << "column " << first.j;
+    break;
+  case BLK:
+    if (jigsaw())
+      str << "region " << regions_[first.i][first.j];
+    else
+      str << "block " << first;
+    break;
+  case DIAG:
+    str << (first.j == 0 ? "diagonal" : "anti-diagonal");
+    break;
+  case WINDOW:
+    str << "window " << first;
+    break;
+  }
+  return str.str();
+}
+
+string Topology::ToString() const {
+  stringstream str;
+  if (diagonal_)
+    str << "diagonal\n";
+  if (windoku_)
+    str << "windoku\n";
+  if (jigsaw()) {
+    str << "jigsaw\n";
+    for (int i = 0; i < regions_.size(); i++)
+      str << regions_[i] << '\n';
+  }
+  return str.str();
+}
@@ -0,0 +1,107 @@
+#ifndef __TOPOLOGY_HEADER__
+#define __TOPOLOGY_HEADER__
+
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "cell.h"
+#include "symset.h"
+
+// The kinds of unit a topology is made of. Jigsaw regions take the place
+// of blocks, so they are BLK units.
+enum grouptype {
+  ROW,
+  COL,
+  BLK,
+  DIAG,
+  WINDOW
+};
+
+// Two units sharing more than one cell, such as a row and a block. The
+// shared cells are given by their positions in each unit.
+struct intersection {
+  unsigned int units[2];
+  symset shared[2];
+};
+
+// The units of a puzzle: groups of cells that must each contain every
+// symbol exactly once. Topologies are built once per layout and shared by
+// every board using that layout, so the tables below are never rebuilt
+// during a solve.
+class Topology {
+private:
+  unsigned int length_;
+  unsigned int blocksize_;
+  bool diagonal_;
+  bool windoku_;
+  std::vector<std::string> regions_;
+  std::vector<std::vector<cell> > units_;
+  std::vector<grouptype> kinds_;
+  // Indexed by Topology::index().
+  std::vector<std::vector<unsigned int> > cell_units_;
+  // Where the cell sits in each of its units, in the order of cell_units_.
+  std::vector<std::vector<unsigned int> > cell_positions_;
+  std::vector<std::vector<cell> > peers_;
+  std::vector<intersection> intersections_;
+
+  Topology(unsigned int length, bool diagonal, bool windoku,
+           const std::vector<std::string> &regions);
+
+public:
+  // Rows, columns and blocks.
+  static const Topology *Standard(unsigned int length);
+  // Extra diagonal units (X-sudoku), window units (windoku), and jigsaw
+  // regions replacing the blocks if 'regions' is non-empty. Each region is
+  // labelled by a character, one row of labels per board row.
+  static const Topology *Get(unsigned int length, bool diagonal,
+                             bool windoku,
+                             const std::vector<std::string> &regions);
+  // Reads the variant lines that may follow the rows of a puzzle file:
+  // "diagonal", "windoku", and "jigsaw" followed by one row of region
+  // labels per board row.
+  static const Topology *Parse(unsigned int length, std::istream &in);
+
+  unsigned int length() const { return length_; }
+  unsigned int blocksize() const { return blocksize_; }
+  bool diagonal() const { return diagonal_; }
+  bool windoku() const { return windoku_; }
+  bool jigsaw() const { return !regions_.empty(); }
+  bool standard() const { return !diagonal_ && !windoku_ && !jigsaw(); }
+
+  // Position of a cell in per-cell tables.
+  unsigned int index(const cell &c) const { return c.i * length_ + c.j; }
+
+  // The number of units.
+  unsigned int size() const { return units_.size(); }
+  const std::vector<cell> &unit(unsigned int u) const { return units_[u]; }
+  grouptype kind(unsigned int u) const { return kinds_[u]; }
+  // The units containing this cell.
+  const std::vector<unsigned int> &units(const cell &c) const {
+    return cell_units_[index(c)];
+  }
+  // The position of this cell in each of units(c), as an index into
+  // unit(u).
+  const std::vector<unsigned int> &positions(const cell &c) const {
+    return cell_positions_[index(c)];
+  }
+  // The cells sharing a unit with this cell, each listed once.
+  const std::vector<cell> &peers(const cell &c) const {
+    return peers_[index(c)];
+  }
+  // Every pair of units sharing more than one cell, each listed once.
+  const std::vector<intersection> &intersections() const {
+    return intersections_;
+  }
+
+  // A human readable name, such as "row 3" or "block (3,6)".
+  std::string UnitName(unsigned int u) const;
+  // The variant lines Parse() would read back to build this topology.
+  std::string ToString() const;
+
+private:
+  void AddUnit(grouptype kind, const std::vector<cell> &cells);
+  void FindIntersections();
+};
+
+#endif // __TOPOLOGY_HEADER__
@@ -0,0 +1,195 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "io.h"
+#include "trace.h"
+
+using namespace std;
+
+// Events a thread can have waiting for the writer; a power of two.
+static const size_t RING_EVENTS = 1 << 16;
+// How often the writer drains the rings.
+static const chrono::milliseconds DRAIN (2);
+
+// A ring with a single producer, the thread it belongs to, and a single
+// consumer, the writer.
+struct tracering {
+  vector<traceevent> events;
+  unsigned int tid;
+  // The next event to drain and the next to fill. The writer only moves
+  // 'head' every DRAIN, so sharing its cache line with 'tail' costs little.
+  atomic<size_t> head;
+  atomic<size_t> tail;
+  atomic<unsigned long> dropped;
+
+  explicit tracering(unsigned int tid)
+    : events(RING_EVENTS), tid(tid), head(0), tail(0), dropped(0) { }
+};
+
+// The calling thread's ring, and the id of the Tracer it belongs to.
+struct ringcache {
+  unsigned long tracer;
+  tracering *ring;
+};
+static thread_local ringcache local = { 0, NULL };
+// Ids handed out to Tracers, from 1.
+static atomic<unsigned long> tracers (0);
+
+Tracer::Tracer(const string &path) : id_(++tracers), stop_(false) {
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  error_ = fd_ < 0 ? errno : 0;
+  clock_gettime(CLOCK_MONOTONIC, &start_);
+  writer_ = thread(&Tracer::Write, this);
+}
+
+Tracer::~Tracer() {
+  Close();
+  for (int r = 0; r < rings_.size(); r++)
+    delete rings_[r];
+}
+
+int Tracer::Close() {
+  if (!writer_.joinable())
+    return error_;
+  stop_.store(true);
+  writer_.join();
+  if (fd_ >= 0 && close(fd_) < 0 && !error_)
+    error_ = errno;
+  fd_ = -1;
+  return error_;
+}
+
+void Tracer::Begin(const char *name, const char *key, long value) {
+  traceevent e = { 0, name, 'B', -1, -1, key, value, NULL };
+  Record(e);
+}
+
+void Tracer::End(const char *name) {
+  traceevent e = { 0, name, 'E', -1, -1, NULL, 0, NULL };
+  Record(e);
+}
+
+void Tracer::Guess(const cell &c, const string &token) {
+  traceevent e = { 0, "guess", 'B', static_cast<int>(c.i),
+                   static_cast<int>(c.j), "symbol", 0, token.c_str() };
+  Record(e);
+}
+
+void Tracer::Count(const char *name, long value) {
+  traceevent e = { 0, name, 'C', -1, -1, name, value, NULL };
+  Record(e);
+}
+
+unsigned long Tracer::dropped() {
+  lock_guard<mutex> hold (lock_);
+  unsigned long total = 0;
+  for (int r = 0; r < rings_.size(); r++)
+    total += rings_[r]->dropped.load(memory_order_relaxed);
+  return total;
+}
+
+void Tracer::Record(traceevent &e) {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  e.ns = (now.tv_sec - start_.tv_sec) * 1000000000l +
+    (now.tv_nsec - start_.tv_nsec);
+  tracering *r = Ring();
+  size_t tail = r->tail.load(memory_order_relaxed);
+  if (tail - r->head.load(memory_order_acquire) == r->events.size()) {
+    r->dropped.fetch_add(1, memory_order_relaxed);
+    return;
+  }
+  r->events[tail & (r->events.size() - 1)] = e;
+  r->tail.store(tail + 1, memory_order_release);
+}
+
+tracering *Tracer::Ring() {
+  if (local.tracer != id_) {
+    lock_guard<mutex> hold (lock_);
+    tracering *r = new tracering(rings_.size() + 1);
+    rings_.push_back(r);
+    local.tracer = id_;
+    local.ring = r;
+  }
+  return local.ring;
+}
+
+void Tracer::Drain(string &buffer, bool &first) {
+  vector<tracering *> rings;
+  {
+    lock_guard<mutex> hold (lock_);
+    rings = rings_;
+  }
+  int pid = getpid();
+  char line[256];
+  for (int k = 0; k < rings.size(); k++) {
+    tracering &r = *rings[k];
+    size_t head = r.head.load(memory_order_relaxed);
+    size_t tail = r.tail.load(memory_order_acquire);
+    for (; head != tail; head++) {
+      const traceevent &e = r.events[head & (r.events.size() - 1)];
+      int n = snprintf(line, sizeof(line),
+                       "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lu.%03lu,"
+                       "\"pid\":%d,\"tid\":%u", first ? "" : ",\n", e.name,
+                       e.phase, e.ns / 1000, e.ns % 1000, pid, r.tid);
+      buffer.append(line, n);
+      first = false;
+      if (e.row >= 0 || e.key) {
+        buffer += ",\"args\":{";
+        if (e.row >= 0) {
+          n = snprintf(line, sizeof(line), "\"row\":%d,\"col\":%d%s", e.row,
+                       e.col, e.key ? "," : "");
+          buffer.append(line, n);
+        }
+        if (e.key && e.text) {
+          n = snprintf(line, sizeof(line), "\"%s\":\"", e.key);
+          buffer.append(line, n);
+          for (const char *t = e.text; *t; t++) {
+            if (*t == '"' || *t == '\\')
+              buffer += '\\';
+            buffer += *t;
+          }
+          buffer += '"';
+        } else if (e.key) {
+          n = snprintf(line, sizeof(line), "\"%s\":%ld", e.key, e.value);
+          buffer.append(line, n);
+        }
+        buffer += '}';
+      }
+      buffer += '}';
+    }
+    r.head.store(head, memory_order_release);
+  }
+}
+
+void Tracer::Write() {
+  string buffer = "{\"traceEvents\":[\n";
+  buffer.reserve(2 * WRITE_BYTES);
+  bool first = true;
+  for (;;) {
+    // Checked before draining, so the last drain sees every event.
+    bool last = stop_.load();
+    Drain(buffer, first);
+    if (last)
+      break;
+    if (buffer.size() >= WRITE_BYTES)
+      Output(buffer);
+    this_thread::sleep_for(DRAIN);
+  }
+  char end[128];
+  snprintf(end, sizeof(end), "\n],\"displayTimeUnit\":\"ns\","
+           "\"otherData\":{\"dropped\":%lu}}\n", dropped());
+  buffer += end;
+  Output(buffer);
+}
+
+void Tracer::Output(string &buffer) {
+  // Once the file has failed, events are still drained, so that the
+  // rings keep moving, but no longer written.
+  if (!error_ && !Flush(fd_, buffer))
+    error_ = errno;
+  buffer.clear();
+}
@@ -0,0 +1,107 @@
+#ifndef __TRACE_HEADER__
+#define __TRACE_HEADER__
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+
+#include "cell.h"
+
+// One event of a timeline. Names and keys must be string literals, or
+// otherwise outlive the Tracer, since they are only formatted later.
+struct traceevent {
+  // Nanoseconds since the Tracer started.
+  unsigned long ns;
+  const char *name;
+  // 'B' begins a span, 'E' ends the innermost one and 'C' sets a counter.
+  char phase;
+  // The cell of a guess, or -1.
+  int row, col;
+  // An argument written as "key": value, if 'key' is set, or as
+  // "key": "text" if 'text' is set too.
+  const char *key;
+  long value;
+  const char *text;
+};
+
+struct tracering;
+
+// Records timelines of solves to a file in the Chrome trace-event format,
+// for chrome://tracing or Perfetto. Each thread records into a ring of
+// its own, without locking, and a writer thread drains the rings into
+// the file as they fill, so tracing stays off the solvers' critical path.
+// Events that find their ring full are dropped and counted rather than
+// waiting for the writer.
+//
+// Every thread that records must be finished before the Tracer is
+// closed or destroyed, which writes the remaining events and closes the
+// file.
+class Tracer {
+private:
+  int fd_;
+  // Told apart from earlier Tracers at the same address by the threads'
+  // cached rings.
+  unsigned long id_;
+  timespec start_;
+  std::mutex lock_;
+  std::vector<tracering *> rings_;
+  std::atomic<bool> stop_;
+  std::thread writer_;
+  // The errno of the first failure to open or write the file, after
+  // which the writer drops events. Only the writer sets it until closed.
+  int error_;
+
+  Tracer(const Tracer &);
+  Tracer &operator=(const Tracer &);
+
+public:
+  // Starts writing a trace to 'path'.
+  explicit Tracer(const std::string &path);
+  ~Tracer();
+
+  void Begin(const char *name, const char *key = NULL, long value = 0);
+  void End(const char *name);
+  // Begins the span of guessing the symbol 'token' for cell 'c'. The
+  // token must outlive the Tracer, as those of alphabets do.
+  void Guess(const cell &c, const std::string &token);
+  // Sets the counter 'name' to 'value' from now on.
+  void Count(const char *name, long value);
+
+  // Events lost to full rings so far.
+  unsigned long dropped();
+
+  // Writes the remaining events and closes the file. Returns 0, or the
+  // errno of the failure that stopped the file being written in full.
+  int Close();
+
+private:
+  void Record(traceevent &e);
+  tracering *Ring();
+  void Write();
+  // Writes out 'buffer' and empties it, unless the file has failed.
+  void Output(std::string &buffer);
+  // Formats the events waiting in every ring into 'buffer'.
+  void Drain(std::string &buffer, bool &first);
+};
+
+// A span over the scope of one of these, if 'trace' is set.
+class tracespan {
+private:
+  Tracer *trace_;
+  const char *name_;
+
+public:
+  tracespan(Tracer *trace, const char *name) : trace_(trace), name_(name) {
+    if (trace_)
+      trace_->Begin(name_);
+  }
+  ~tracespan() {
+    if (trace_)
+      trace_->End(name_);
+  }
+};
+
+#endif // __TRACE_HEADER__
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cassert>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "verify.h"
+
+using namespace std;
+
+Verifier::Verifier(const Topology *topology)
+  : topology_(topology), words_((topology->length() + 63) / 64) {
+  unsigned int length = topology->length();
+  seen_.resize(topology->size() * words_);
+  cell_starts_.push_back(0);
+  for (int i = 0; i < length; i++) {
+    for (int j = 0; j < length; j++) {
+      const vector<unsigned int> &units = topology->units(cell(i, j));
+      for (int u = 0; u < units.size(); u++)
+        unit_offsets_.push_back(units[u] * words_);
+      cell_starts_.push_back(unit_offsets_.size());
+    }
+  }
+  for (unsigned int u = 0; u < topology->size(); u++) {
+    const vector<cell> &unit = topology->unit(u);
+    assert(unit.size() == length);
+    for (int c = 0; c < unit.size(); c++)
+      unit_cells_.push_back(topology->index(unit[c]));
+  }
+  codes_.resize(length * length);
+  given_codes_.resize(length * length);
+}
+
+verdict Verifier::Check(const unsigned int *givens,
+                        const unsigned int *solution) {
+  unsigned int length = topology_->length();
+  if (words_ > 1)
+    return Scan(givens, solution);
+  // Accept the usual valid solution with no stores: every code in range
+  // and matching its given, and every unit's symbols filling its mask.
+  unsigned int bad = 0;
+  for (unsigned int x = 0; x < length * length; x++) {
+    unsigned int code = solution[x];
+    bad |= code - 1 >= length;
+    if (givens)
+      bad |= givens[x] != 0 && givens[x] != code;
+  }
+  if (bad)
+    return Scan(givens, solution);
+  uint64_t full = length == 64 ? ~static_cast<uint64_t>(0)
+                               : (static_cast<uint64_t>(1) << length) - 1;
+  const unsigned int *cells = &unit_cells_[0];
+  for (unsigned int u = 0; u < topology_->size(); u++, cells += length) {
+    uint64_t mask = 0;
+    for (unsigned int c = 0; c < length; c++)
+      mask |= static_cast<uint64_t>(1) << (solution[cells[c]] - 1);
+    if (mask != full)
+      return Scan(givens, solution);
+  }
+  return verdict();
+}
+
+verdict Verifier::Scan(const unsigned int *givens,
+                       const unsigned int *solution) {
+  unsigned int length = topology_->length();
+  fill(seen_.begin(), seen_.end(), 0);
+  const unsigned int *offsets = &unit_offsets_[0];
+  uint64_t *seen = &seen_[0];
+  unsigned int x = 0, k = 0;
+  for (; x < length * length; x++) {
+    unsigned int code = solution[x];
+    if (code - 1 >= length)
+      break;
+    if (givens && givens[x] != 0 && givens[x] != code)
+      break;
+    unsigned int word = (code - 1) >> 6;
+    uint64_t bit = static_cast<uint64_t>(1) << ((code - 1) & 63);
+    uint64_t repeated = 0;
+    for (unsigned int end = cell_starts_[x + 1]; k < end; k++) {
+      uint64_t &mask = seen[offsets[k] + word];
+      repeated |= mask & bit;
+      mask |= bit;
+    }
+    if (repeated)
+      break;
+  }
+  verdict v;
+  if (x == length * length)
+    return v;
+  // Work out what stopped the scan.
+  unsigned int code = solution[x];
+  v.at = cell(x / length, x % length);
+  v.code = code;
+  if (code == 0) {
+    v.problem = verdict::UNFILLED;
+  }
+  else if (code > length) {
+    v.problem = verdict::BAD_SYMBOL;
+  }
+  else if (givens && givens[x] != 0 && givens[x] != code) {
+    v.problem = verdict::GIVEN_CHANGED;
+    v.given = givens[x];
+  }
+  else {
+    v.problem = verdict::REPEATED;
+    const vector<unsigned int> &units = topology_->units(v.at);
+    for (int u = 0; u < units.size() && v.unit < 0; u++) {
+      cell other = Find(units[u], code, v.at, solution);
+      if (other != v.at && topology_->index(other) < x) {
+        v.unit = units[u];
+        v.first = other;
+      }
+    }
+  }
+  return v;
+}
+
+verdict Verifier::Check(const Sudoku &puzzle, const Sudoku &solution) {
+  unsigned int length = topology_->length();
+  assert(&puzzle.topology() == topology_ && &solution.topology() == topology_);
+  // Codes index the solution's alphabet, which may order symbols
+  // differently from the puzzle's.
+  const Alphabet &alphabet = solution.alphabet();
+  for (int i = 0; i < length; i++) {
+    for (int j = 0; j < length; j++) {
+      const symset &dom = solution.domain(i, j);
+      codes_[i * length + j] = dom.single() ? dom.front() + 1 : 0;
+      const symset &given = puzzle.domain(i, j);
+      given_codes_[i * length + j] = 0;
+      if (given.single())
+        given_codes_[i * length + j] =
+          alphabet.Find(puzzle.alphabet()[given.front()]) + 1;
+    }
+  }
+  return Check(&given_codes_[0], &codes_[0]);
+}
+
+cell Verifier::Find(unsigned int unit, unsigned int code, const cell &at,
+                    const unsigned int *solution) const {
+  const vector<cell> &cells = topology_->unit(unit);
+  for (vector<cell>::const_iterator it = cells.begin();
+       it != cells.end(); ++it)
+    if (*it != at && solution[topology_->index(*it)] == code)
+      return *it;
+  return at;
+}
+
+string Verifier::Describe(const verdict &v,
+                          const vector<string> &tokens) const {
+  stringstream str;
+  switch (v.problem) {
+  case verdict::VALID:
+    str << "valid";
+    break;
+  case verdict::UNFILLED:
+    str << "cell " << v.at << " is unfilled";
+    break;
+  case verdict::BAD_SYMBOL:
+    str << "cell " << v.at << " holds a symbol outside the alphabet";
+    break;
+  case verdict::GIVEN_CHANGED:
+    str << "cell " << v.at << " holds " << tokens[v.code - 1]
+        << " but the puzzle gives ";
+    if (v.given - 1 < tokens.size())
+      str << tokens[v.given - 1];
+    else
+      str << "a symbol outside the alphabet";
+    break;
+  case verdict::REPEATED:
+    str << topology_->UnitName(v.unit) << " repeats " << tokens[v.code - 1]
+        << " at " << v.at << " and " << v.first;
+    break;
+  }
+  return str.str();
+}
@@ -0,0 +1,85 @@
+#ifndef __VERIFY_HEADER__
+#define __VERIFY_HEADER__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "cell.h"
+#include "sudoku.h"
+#include "topology.h"
+
+// The outcome of checking a solution, locating the first fault found.
+struct verdict {
+  enum fault {
+    VALID,
+    // A cell has no symbol.
+    UNFILLED,
+    // A cell holds a code outside the alphabet.
+    BAD_SYMBOL,
+    // A cell differs from the given in the puzzle.
+    GIVEN_CHANGED,
+    // A unit holds a symbol twice.
+    REPEATED
+  };
+
+  fault problem;
+  // The faulty cell, and for REPEATED the earlier cell of 'unit' holding
+  // the same symbol.
+  cell at;
+  cell first;
+  int unit;
+  // The code found at 'at', and for GIVEN_CHANGED the given's.
+  unsigned int code;
+  unsigned int given;
+
+  verdict() : problem(VALID), unit(-1), code(0), given(0) { }
+  bool valid() const { return problem == VALID; }
+};
+
+// Checks solutions against their puzzles with a bitmask per unit of the
+// symbols in it. With every cell filled and every unit's mask full, each
+// unit holds a permutation of the alphabet.
+//
+// Cells are given as codes, 0 for unknown and otherwise one more than the
+// symbol, as stored in corpora. A verifier keeps scratch space, so each
+// thread needs its own.
+class Verifier {
+private:
+  const Topology *topology_;
+  // Mask words per unit.
+  unsigned int words_;
+  std::vector<uint64_t> seen_;
+  // The mask offsets of the units of each cell, in unit_offsets_ from
+  // cell_starts_[x] to cell_starts_[x + 1].
+  std::vector<unsigned int> unit_offsets_;
+  std::vector<unsigned int> cell_starts_;
+  // The cells of each unit, 'length' per unit.
+  std::vector<unsigned int> unit_cells_;
+  std::vector<unsigned int> codes_, given_codes_;
+
+public:
+  explicit Verifier(const Topology *topology);
+
+  const Topology &topology() const { return *topology_; }
+
+  // 'givens' may be NULL to only check that 'solution' is complete.
+  verdict Check(const unsigned int *givens, const unsigned int *solution);
+  verdict Check(const Sudoku &puzzle, const Sudoku &solution);
+
+  // Describes a verdict, such as "row 3 repeats 5 at (2,7) and (2,1)".
+  // tokens[code - 1] is the token for a code.
+  std::string Describe(const verdict &v,
+                       const std::vector<std::string> &tokens) const;
+
+private:
+  // Finds the first fault in cell order, marking symbols off in per-unit
+  // masks. Check() only falls back to it for faulty solutions and boards
+  // too large for a single mask word.
+  verdict Scan(const unsigned int *givens, const unsigned int *solution);
+  // Finds the cell of a unit holding a code, other than 'at'.
+  cell Find(unsigned int unit, unsigned int code, const cell &at,
+            const unsigned int *solution) const;
+};
+
+#endif // __VERIFY_HEADER__